@@ -0,0 +1,513 @@
+// bench.c   - measure sbif against PNG and QOI over a corpus of images
+// -----------------------------------------------------------------------
+
+// every PNG in the corpus directory is encoded and decoded by each codec
+// in its own child process so that the peak RSS reported belongs to that
+// codec alone.  PNG and QOI are given RGBA, sbif is given what sbif
+// itself would compress: only the channels the png has, 16 bits if it is
+// 16 bit and indices if it has few enough colors.  each measurement is
+// the best of several runs, raw MB/s are computed from the uncompressed
+// 8 bit RGBA size for every codec so that they compare, and every round
+// trip is checked against the pixels it started from.  results go to
+// stdout, bench.csv and bench.json
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "sbif.h"
+#include "sbif_png.h"
+#include "qoi.h"
+#include "lodepng.h"
+
+// -----------------------------------------------------------------------
+
+#define NUM_CODECS (3)
+
+enum { SBIF, PNG, QOI };
+
+static const char *codec_name[NUM_CODECS] = { "sbif", "png", "qoi" };
+
+// -----------------------------------------------------------------------
+
+typedef struct
+{
+    int ok;                 // round trip reproduced the source pixels
+    uint32_t w, h;
+    size_t raw;             // uncompressed 8 bit RGBA bytes
+    size_t comp;            // compressed bytes
+    double enc_ms;          // best of runs
+    double dec_ms;
+    sbif_stats_t enc_t;     // sbif per stage times of the best runs
+    sbif_stats_t dec_t;
+    long rss_kb;            // peak RSS of the child, filled in by parent
+} result_t;
+
+// -----------------------------------------------------------------------
+
+char **files;               // PNG files in the corpus
+int num_files;
+
+int runs = 3;               // bench -n
+char *csv_name  = "bench.csv";  // bench -C
+char *json_name = "bench.json"; // bench -J
+
+sbif_options_t options;     // the same flags as sbif, one thread unless -j
+int no_palette;             // bench -P, as sbif -P
+
+// -----------------------------------------------------------------------
+
+static int is_png(const char *name)
+{
+    size_t n = strlen(name);
+
+    return (n > 4) && (strcasecmp(name + n - 4, ".png") == 0);
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+// -----------------------------------------------------------------------
+
+static void scan_corpus(char *dir)
+{
+    DIR *d;
+    struct dirent *e;
+    char *path;
+
+    if ((d = opendir(dir)) == NULL)
+    {
+        printf("bench: cannot open corpus directory %s\n", dir);
+        exit(1);
+    }
+
+    while ((e = readdir(d)) != NULL)
+    {
+        if (is_png(e->d_name))
+        {
+            path = malloc(strlen(dir) + strlen(e->d_name) + 2);
+            sprintf(path, "%s/%s", dir, e->d_name);
+
+            files = realloc(files, (num_files + 1) * sizeof(char *));
+            files[num_files++] = path;
+        }
+    }
+
+    closedir(d);
+    qsort(files, num_files, sizeof(char *), by_name);
+}
+
+// -----------------------------------------------------------------------
+// the encode and decode of one codec over one image, best of runs.  sbif
+// gets png, the others rgba
+
+static void measure(int codec, uint8_t *rgba, sbif_png_t *png, result_t *r)
+{
+    uint8_t *comp = NULL;
+    uint8_t *out  = NULL;
+    size_t stride = 0;
+    size_t len;
+    unsigned w, h;
+    sbif_stats_t t;
+    double t0, ms;
+    int i;
+
+    FILE *fp;
+
+    r->enc_ms = r->dec_ms = 1e300;
+    r->ok     = 1;
+
+    memset(&t, 0, sizeof(t));   // only sbif has stage times
+
+    if (codec == SBIF)
+    {
+        stride = (size_t)r->w * format_bpp[png->format] * (png->depth / 8);
+    }
+
+    for (i = 0; i != runs; i++)
+    {
+        free(comp);
+        free(out);
+
+        comp = out = NULL;
+
+        t0 = sbif_now();
+
+        switch (codec)
+        {
+            case SBIF:
+                fp = open_memstream((char **)&comp, &len);
+                sbif_png_encode(fp, png, &options, &t);
+                fclose(fp);
+                break;
+
+            case PNG:
+                lodepng_encode32(&comp, &len, rgba, r->w, r->h);
+                break;
+
+            case QOI:
+                comp = qoi_encode(rgba, r->w, r->h, &len);
+                break;
+        }
+
+        ms = sbif_now() - t0;
+
+        if (ms < r->enc_ms)
+        {
+            r->enc_ms = ms;
+            r->enc_t  = t;
+        }
+
+        r->comp = len;
+        t0      = sbif_now();
+
+        switch (codec)
+        {
+            case SBIF:
+                out = malloc(stride * r->h);
+                r->ok &= (sbif_decode_pixels(comp, len, out, stride,
+                                             png->format, 0, 0, r->w, r->h,
+                                             &t) == 0);
+                break;
+
+            case PNG:
+                r->ok &= (lodepng_decode32(&out, &w, &h, comp, len) == 0);
+                break;
+
+            case QOI:
+                out = qoi_decode(comp, len, &w, &h);
+                break;
+        }
+
+        ms = sbif_now() - t0;
+
+        if (ms < r->dec_ms)
+        {
+            r->dec_ms = ms;
+            r->dec_t  = t;
+        }
+
+        r->ok &= (out != NULL) && ((codec == SBIF)
+               ? (memcmp(png->pixels, out, stride * r->h) == 0)
+               : (memcmp(rgba, out, r->raw) == 0));
+    }
+
+    free(comp);
+    free(out);
+}
+
+// -----------------------------------------------------------------------
+// runs in a child, the result comes back up the pipe
+
+static void child(int codec, char *file, int fd)
+{
+    result_t r;
+    sbif_png_t png;
+    uint8_t *rgba = NULL;
+    unsigned w, h;
+    unsigned error;
+
+    memset(&r, 0, sizeof(r));
+
+    if (codec == SBIF)
+    {
+        error = sbif_png_load(file, &png);
+        w     = png.width;
+        h     = png.height;
+
+        if ((error == 0) && !no_palette)
+        {
+            sbif_png_palette(&png);
+        }
+    }
+    else
+    {
+        error = lodepng_decode32_file(&rgba, &w, &h, file);
+    }
+
+    if (error == 0)
+    {
+        r.w   = w;
+        r.h   = h;
+        r.raw = (size_t)w * h * 4;
+
+        measure(codec, rgba, &png, &r);
+    }
+
+    write(fd, &r, sizeof(r));
+    _exit(0);
+}
+
+// -----------------------------------------------------------------------
+
+static void run_one(int codec, char *file, result_t *r)
+{
+    struct rusage ru;
+    int status;
+    int fd[2];
+    pid_t pid;
+
+    memset(r, 0, sizeof(*r));
+
+    fflush(stdout);
+    pipe(fd);
+
+    if ((pid = fork()) == 0)
+    {
+        close(fd[0]);
+        child(codec, file, fd[1]);
+    }
+
+    close(fd[1]);
+
+    if (read(fd[0], r, sizeof(*r)) != sizeof(*r))
+    {
+        r->ok = 0;
+    }
+
+    close(fd[0]);
+
+    wait4(pid, &status, 0, &ru);
+    r->rss_kb = ru.ru_maxrss;
+}
+
+// -----------------------------------------------------------------------
+
+static double mbs(size_t bytes, double ms)
+{
+    return (ms > 0) ? (bytes / 1e6) / (ms / 1000) : 0;
+}
+
+static double ratio(size_t raw, size_t comp)
+{
+    return comp ? (double)raw / comp : 0;
+}
+
+// -----------------------------------------------------------------------
+
+static void print_row(const char *name, const char *codec, result_t *r)
+{
+    printf("%-24s %-5s %10zu %8.2f %9.1f %9.1f %8ld %s\n", name, codec,
+           r->comp, ratio(r->raw, r->comp), mbs(r->raw, r->enc_ms),
+           mbs(r->raw, r->dec_ms), r->rss_kb, r->ok ? "" : "FAILED");
+}
+
+// -----------------------------------------------------------------------
+
+static void write_csv(result_t *res)
+{
+    result_t *r;
+    FILE *fp;
+    int i, c;
+
+    fp = fopen(csv_name, "w");
+
+    fprintf(fp, "file,codec,width,height,raw,comp,ratio,enc_ms,dec_ms,"
+                "enc_mbs,dec_mbs,rss_kb,ok,enc_split_ms,enc_stage12_ms,"
+                "enc_stage3_ms,dec_stage3_ms,dec_stage12_ms\n");
+
+    for (i = 0; i != num_files; i++)
+    {
+        for (c = 0; c != NUM_CODECS; c++)
+        {
+            r = &res[(i * NUM_CODECS) + c];
+
+            fprintf(fp, "%s,%s,%u,%u,%zu,%zu,%.4f,%.3f,%.3f,%.2f,%.2f,"
+                        "%ld,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                    files[i], codec_name[c], r->w, r->h, r->raw, r->comp,
+                    ratio(r->raw, r->comp), r->enc_ms, r->dec_ms,
+                    mbs(r->raw, r->enc_ms), mbs(r->raw, r->dec_ms),
+                    r->rss_kb, r->ok, r->enc_t.split, r->enc_t.stage12,
+                    r->enc_t.stage3, r->dec_t.stage3, r->dec_t.stage12);
+        }
+    }
+
+    fclose(fp);
+}
+
+// -----------------------------------------------------------------------
+
+static void write_json(result_t *res, result_t *total)
+{
+    result_t *r;
+    FILE *fp;
+    int i, c;
+
+    fp = fopen(json_name, "w");
+
+    fprintf(fp, "{\n  \"runs\": %d,\n  \"images\": [\n", runs);
+
+    for (i = 0; i != num_files; i++)
+    {
+        fprintf(fp, "    { \"file\": \"%s\", \"width\": %u, "
+                    "\"height\": %u, \"raw\": %zu, \"codecs\": {\n",
+                files[i], res[i * NUM_CODECS].w, res[i * NUM_CODECS].h,
+                res[i * NUM_CODECS].raw);
+
+        for (c = 0; c != NUM_CODECS; c++)
+        {
+            r = &res[(i * NUM_CODECS) + c];
+
+            fprintf(fp, "      \"%s\": { \"comp\": %zu, \"ratio\": %.4f, "
+                        "\"enc_ms\": %.3f, \"dec_ms\": %.3f, "
+                        "\"enc_mbs\": %.2f, \"dec_mbs\": %.2f, "
+                        "\"rss_kb\": %ld, \"ok\": %s",
+                    codec_name[c], r->comp, ratio(r->raw, r->comp),
+                    r->enc_ms, r->dec_ms, mbs(r->raw, r->enc_ms),
+                    mbs(r->raw, r->dec_ms), r->rss_kb,
+                    r->ok ? "true" : "false");
+
+            if (c == SBIF)
+            {
+                fprintf(fp, ",\n        \"encode\": { \"split_ms\": %.3f, "
+                            "\"stage12_ms\": %.3f, \"stage3_ms\": %.3f },"
+                            "\n        \"decode\": { \"stage3_ms\": %.3f, "
+                            "\"stage12_ms\": %.3f }",
+                        r->enc_t.split, r->enc_t.stage12, r->enc_t.stage3,
+                        r->dec_t.stage3, r->dec_t.stage12);
+            }
+
+            fprintf(fp, " }%s\n", (c != NUM_CODECS - 1) ? "," : "");
+        }
+
+        fprintf(fp, "    } }%s\n", (i != num_files - 1) ? "," : "");
+    }
+
+    fprintf(fp, "  ],\n  \"aggregate\": {\n");
+
+    for (c = 0; c != NUM_CODECS; c++)
+    {
+        r = &total[c];
+
+        fprintf(fp, "    \"%s\": { \"raw\": %zu, \"comp\": %zu, "
+                    "\"ratio\": %.4f, \"enc_mbs\": %.2f, \"dec_mbs\": %.2f, "
+                    "\"peak_rss_kb\": %ld, \"ok\": %s }%s\n",
+                codec_name[c], r->raw, r->comp, ratio(r->raw, r->comp),
+                mbs(r->raw, r->enc_ms), mbs(r->raw, r->dec_ms), r->rss_kb,
+                r->ok ? "true" : "false", (c != NUM_CODECS - 1) ? "," : "");
+    }
+
+    fprintf(fp, "  }\n}\n");
+    fclose(fp);
+}
+
+// -----------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    result_t *res;
+    result_t total[NUM_CODECS];
+    result_t *r;
+    char *name;
+    int opt;
+    int i, c;
+
+    while ((opt = getopt(argc, argv, "n:C:J:mrsxlceukPt:b:j:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': runs                 = atoi(optarg); break;
+            case 'C': csv_name             = optarg;       break;
+            case 'J': json_name            = optarg;       break;
+            case 'm': options.max_mode     = 1;            break;
+            case 'r': options.rice_mode    = 1;            break;
+            case 's': options.shift_mode   = 1;            break;
+            case 'x': options.cross_mode   = 1;            break;
+            case 'l': options.split_mode   = 1;            break;
+            case 'c': options.continuous   = 1;            break;
+            case 'e': options.entropy_mode = 1;            break;
+            case 'u': options.repeat_mode  = 1;            break;
+            case 'k': options.copy_mode    = 1;            break;
+            case 'P': no_palette           = 1;            break;
+
+            case 't':
+                options.tile_w = options.tile_h = atoll(optarg);
+                break;
+
+            case 'b':
+                options.tile_w = -1;
+                options.tile_h = atoll(optarg);
+                break;
+
+            case 'j':
+                options.threads = atoi(optarg);
+                break;
+
+            default:
+                optind = argc;
+        }
+    }
+
+    if ((optind != argc - 1) || (runs < 1))
+    {
+        printf("usage: bench [-n runs] [-C out.csv] [-J out.json] [-m] [-r] "
+               "[-s] [-x] [-l] [-c]\n             [-e] [-u] [-k] [-P] "
+               "[-t size | -b rows] [-j threads] corpus_dir\n"
+               "  the sbif flags are the same as sbif's, -j defaults to one "
+               "thread\n");
+        exit(1);
+    }
+
+    if (options.entropy_mode && options.continuous)
+    {
+        printf("bench: -e and -c can not be used together, as in sbif\n");
+        exit(1);
+    }
+
+    scan_corpus(argv[optind]);
+
+    res = calloc((size_t)num_files * NUM_CODECS, sizeof(result_t));
+    memset(total, 0, sizeof(total));
+
+    printf("%-24s %-5s %10s %8s %9s %9s %8s\n", "image", "codec",
+           "bytes", "ratio", "enc MB/s", "dec MB/s", "RSS kB");
+
+    for (c = 0; c != NUM_CODECS; c++)
+    {
+        total[c].ok = 1;
+    }
+
+    for (i = 0; i != num_files; i++)
+    {
+        name = strrchr(files[i], '/') + 1;
+
+        for (c = 0; c != NUM_CODECS; c++)
+        {
+            r = &res[(i * NUM_CODECS) + c];
+            run_one(c, files[i], r);
+            print_row(name, codec_name[c], r);
+
+            total[c].raw    += r->raw;
+            total[c].comp   += r->comp;
+            total[c].enc_ms += r->enc_ms;
+            total[c].dec_ms += r->dec_ms;
+            total[c].ok     &= r->ok;
+            total[c].rss_kb  = (r->rss_kb > total[c].rss_kb)
+                             ? r->rss_kb : total[c].rss_kb;
+        }
+    }
+
+    printf("\n");
+
+    for (c = 0; c != NUM_CODECS; c++)
+    {
+        print_row("total", codec_name[c], &total[c]);
+    }
+
+    write_csv(res);
+    write_json(res, total);
+
+    printf("\nwrote %s and %s\n", csv_name, json_name);
+
+    return total[SBIF].ok && total[PNG].ok && total[QOI].ok ? 0 : 1;
+}
+
+// =======================================================================
@@ -2,9 +2,9 @@
 // -----------------------------------------------------------------------
 
 #include <stdio.h>
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 #include <zstd.h>
 
@@ -12,25 +12,147 @@
 
 // -----------------------------------------------------------------------
 
-uint16_t width;
-uint16_t height;
+static uint32_t width;      // dimensions of the tile being decompressed
+static uint32_t height;
 
-uint16_t run;
-uint8_t rle;
+static uint32_t image_w;    // dimensions of the whole image
+static uint32_t image_h;
 
-FILE *out_fp;
+static uint32_t tile_w;     // size of each tile, same as image if not tiled
+static uint32_t tile_h;
 
-uint8_t *in_buff;
-uint8_t *out_buff;
+static int64_t rx, ry;      // the region of the image to decompress
+static int64_t rw, rh;
 
-uint8_t *in_p;
-uint8_t *out_p;
+static uint32_t run;
+static uint8_t rle;
+static uint8_t mark8;       // run markers of this image, from the header
+static uint8_t mark16;
 
-uint8_t bits;
-uint8_t num_bits;
+static uint8_t *in_buff;
+static uint8_t *out_buff;
 
-uint8_t *z_buff;
-uint32_t z_size;
+static uint8_t *in_p;
+static uint16_t *out_p;     // current pixel of the scan line
+static uint8_t *lit_p;      // next literal in split mode
+
+static int split;           // literals are in a stream of their own
+static int continuous;      // scan lines are only flushed every segment
+
+static uint8_t bits;
+static uint8_t num_bits;
+
+static uint8_t tag_bits;    // width of scan line tags, from the header
+static int8_t k;            // rice parameter of current scan line or -1
+
+static int depth;           // bits per literal, 8 or 16 or index bits
+static int bytes;           // bytes per channel of the output, 1 or 2
+static uint16_t top;        // the biggest a channel can be, 0xff or 0xffff
+static uint8_t k_base;      // added to every k, 8 for 16 bit channels
+
+static uint8_t *z_buff;
+static uint32_t z_size;
+static size_t z_cap;        // biggest frame once decompressed
+
+static uint16_t *t_buff;    // two channels of the current tile
+static uint16_t *ref;       // the channel before the current one
+static uint16_t *plane_p;   // and the start of the current one
+
+static int channels;        // how many channels the image has
+static uint8_t color;       // and which, as a PNG color type
+static size_t head_size;    // header plus palette, where the frames start
+
+// an indexed image has one plane of indices into this, each color being
+// the channels of the image
+
+static uint8_t palette[256 * 4];
+static int colors;          // zero if not indexed
+
+static size_t out_stride;   // bytes from one output scan line to the next
+static uint8_t out_bpp;     // bytes from one output pixel to the next
+static size_t out_chan[4];  // where each of R, G, B and A go in the output
+static int8_t out_src[4];   // and which channel of the image they are
+static int out_channels;    // how many channels need decompressing
+
+#define UNUSED  (-1)        // the output format does not have this one
+#define OPAQUE  (-2)        // the image does not have it, all 0xff
+
+// the offset of R, G, B and A within an output pixel of each format.  the
+// channels after the last one wanted are not even decompressed
+
+static const int8_t layouts[6][4] =
+{
+    {  0,  1,  2,  3 },     // SBIF_RGBA
+    {  2,  1,  0,  3 },     // SBIF_BGRA
+    {  0,  1,  2, -1 },     // SBIF_RGB
+    {  0, -1, -1, -1 },     // SBIF_GREY
+    {  0,  0,  0,  0 },     // SBIF_PLANAR, a plane apart
+    {  0, -1, -1,  1 }      // SBIF_GREY_ALPHA
+};
+
+// which channel of the image R, G, B and A come from for each PNG color
+// type.  grey is copied to all three colors
+
+static const int8_t sources[7][4] =
+{
+    [COLOR_GREY]       = { 0, 0, 0, OPAQUE },
+    [COLOR_RGB]        = { 0, 1, 2, OPAQUE },
+    [COLOR_GREY_ALPHA] = { 0, 0, 0, 1 },
+    [COLOR_RGBA]       = { 0, 1, 2, 3 }
+};
+
+static const uint8_t color_channels[7] =
+{
+    [COLOR_GREY] = 1, [COLOR_RGB] = 3, [COLOR_GREY_ALPHA] = 2, [COLOR_RGBA] = 4
+};
+
+static uint32_t num_frames;
+static uint8_t *seek_p;     // first entry of the seek table, if tiled
+static uint64_t *frame_off; // file offset and size of each tiles zstd
+static uint32_t *frame_len; // frame, taken from the seek table
+
+static sbif_stats_t *stats; // where to add up what each stage costs
+static int channel;         // which of RGBA is being decompressed
+
+static uint8_t *tag_buff;   // the method of every scan line so far
+static size_t num_tags;
+
+// -----------------------------------------------------------------------
+// every working buffer is carved out of one arena.  it only ever grows so
+// decompressing a batch of images of the same size allocates exactly once.
+// nothing in it is zeroed, every buffer is written before it is read
+
+static uint8_t *arena;
+static size_t arena_size;
+static size_t arena_used;
+
+// -----------------------------------------------------------------------
+// returns NULL when there is no room, which only happens on the first
+// pass where we are just adding up how much room is needed
+
+static void *carve(size_t n)
+{
+    uint8_t *p;
+
+    p = ((arena_used + n) <= arena_size) ? &arena[arena_used] : NULL;
+    arena_used += ARENA_ALIGN(n);
+
+    return p;
+}
+
+// -----------------------------------------------------------------------
+
+static void arena_reserve(size_t n)
+{
+    if (n > arena_size)
+    {
+        free(arena);
+
+        arena      = malloc(n);
+        arena_size = n;
+    }
+    arena_used = 0;
+}
 
 // -----------------------------------------------------------------------
 
@@ -42,25 +164,38 @@ static void reset(void)
 
 // -----------------------------------------------------------------------
 
-void get_run(void)
+static void get_run(void)
 {
+    uint8_t *p;
+
     rle = *in_p++;
     run = 1;
 
-    switch (rle)
+    if (rle == mark8)
     {
-        case MARK8:
-          run = (*in_p++);
-          rle = (*in_p++);
-          break;
+        run = (*in_p++);
+        rle = (*in_p++);
+
+        stats->mark8++;
+        stats->rle_saved += (int64_t)run - 3;
+    }
 
-        // this will probably be somewhat kinda rare ish
+    // this will probably be somewhat kinda rare ish
+
+    else if (rle == mark16)
+    {
+        p = in_p - 1;
+
+        for (run = 0; (*in_p & 0x80) != 0; in_p++)
+        {
+            run = (run << 7) | (*in_p & 0x7f);
+        }
 
-        case MARK16:
-          run  = (*in_p++) << 8;
-          run += (*in_p++);
-          rle  = (*in_p++);
-          break;
+        run = (run << 7) | (*in_p++);
+        rle = (*in_p++);
+
+        stats->mark16++;
+        stats->rle_saved += run - (in_p - p);
     }
 }
 
@@ -91,9 +226,9 @@ static uint8_t read_bit(void)
 
 // -----------------------------------------------------------------------
 
-static uint8_t read_bits(uint8_t n)
+static uint32_t read_bits(uint8_t n)
 {
-    uint8_t c = 0;
+    uint32_t c = 0;
 
     while (n)
     {
@@ -106,8 +241,58 @@ static uint8_t read_bits(uint8_t n)
 }
 
 // -----------------------------------------------------------------------
+// read a literal that was written as is, out of the literal stream in
+// split mode
 
-void flush_bits(void)
+static uint16_t read_raw(void)
+{
+    uint16_t c;
+
+    if (!split)
+    {
+        return read_bits(depth);
+    }
+
+    c = *lit_p++;
+
+    if (bytes == 2)
+    {
+        c = (c << 8) | *lit_p++;
+    }
+
+    return c;
+}
+
+// -----------------------------------------------------------------------
+// read a literal that was written with new_byte()
+
+static uint16_t read_lit(void)
+{
+    uint8_t q;
+    uint16_t z;
+
+    if (k < 0)
+    {
+        return read_raw();
+    }
+
+    q = 0;                  // count the ONE bits of the unary quotient
+
+    while ((q != RICE_LIMIT) && (read_bit() != 0))
+    {
+        q++;
+    }
+
+    z = (q == RICE_LIMIT)
+        ? read_bits(depth)
+        : (q << (k + k_base)) | read_bits(k + k_base);
+
+    return unzigzag(z, top);
+}
+
+// -----------------------------------------------------------------------
+
+static void flush_bits(void)
 {
     while (num_bits != 0)
     {
@@ -120,13 +305,13 @@ void flush_bits(void)
 
 static void horizontal(void)
 {
-    uint16_t i;
+    uint32_t i;
     uint8_t bit;
-    uint8_t c;
+    uint16_t c;
 
     i = width;
 
-    c = read_bits(8);       // read fist pixel of scan line
+    c = read_raw();         // read fist pixel of scan line
     *out_p++ = c;
 
     while (--i)             // must be pre-decrement
@@ -135,7 +320,7 @@ static void horizontal(void)
 
         if (bit != 0)
         {
-            c = read_bits(8);
+            c = read_lit();
         }
 
         *out_p++ = c;
@@ -147,23 +332,113 @@ static void horizontal(void)
 
 static void vertical(void)
 {
-    uint16_t i;
+    uint32_t i;
+    uint32_t n;
     uint8_t bit;
-    uint8_t *q;
+    uint16_t *q;
 
     i = width;
     q = (out_p - width);
 
-    while (i--)             // must be post decrement
+    while (i != 0)
     {
+        // a run of zero bytes is eight pixels the same as above for each
+        // one, so copy as many of those as will fit all at once.  this is
+        // how unchanged scan lines go fast without four bit tags
+
+        n = ((num_bits == 0) && (rle == 0)) ? run : 0;
+        n = (n > (i / 8)) ? (i / 8) : n;
+
+        if (n != 0)
+        {
+            memcpy(out_p, q, n * 8 * sizeof(uint16_t));
+
+            out_p += n * 8;
+            q     += n * 8;
+            i     -= n * 8;
+            run   -= n;
+            continue;
+        }
+
         bit = read_bit();
 
         *out_p = (bit == 0)
             ? *q
-            : read_bits(8);
+            : read_lit();
 
         out_p++;
         q++;
+        i--;
+    }
+}
+
+// -----------------------------------------------------------------------
+// a repeated scan line is just a copy of the one above it, or of the one
+// however many scan lines back the ONE bit after its tag says.  that
+// count is in just enough bits to count up to y
+
+static void repeat(uint32_t y)
+{
+    uint32_t d;
+    uint8_t n;
+
+    d = 1;
+
+    if (read_bit() != 0)
+    {
+        for (n = 1; (y >> n) != 0; n++)
+            ;
+        d = read_bits(n);
+    }
+
+    memcpy(out_p, out_p - ((size_t)d * width), width * sizeof(uint16_t));
+    out_p += width;
+}
+
+// -----------------------------------------------------------------------
+// shifted vertical decompression.  the same as vertical with the scan
+// line above moved over by the shift, its end pixels standing in for any
+// that would be off the end of it
+
+static void shifted(void)
+{
+    int64_t x;
+    int64_t n;
+    int64_t end;
+    int64_t last;
+    int s;
+    uint16_t *q;
+
+    s    = (int)read_bits(SHIFT_BITS) - SHIFT_MAX;
+    q    = (out_p - width);
+    x    = -s;              // where in q the current pixel comes from
+    end  = (int64_t)width - s;
+    last = (s > 0) ? end : width;   // no copying past here either
+
+    while (x != end)
+    {
+        // a run of zero bytes copies straight across the same as it does
+        // for vertical, as long as none of it is off the end of q
+
+        n = ((num_bits == 0) && (rle == 0) && (x >= 0) && (x < last))
+            ? run
+            : 0;
+        n = (n > (last - x) / 8) ? (last - x) / 8 : n;
+
+        if (n != 0)
+        {
+            memcpy(out_p, &q[x], n * 8 * sizeof(uint16_t));
+
+            out_p += n * 8;
+            x     += n * 8;
+            run   -= n;
+            continue;
+        }
+
+        *out_p++ = (read_bit() == 0)
+            ? q[(x < 0) ? 0 : (x >= width) ? width - 1 : x]
+            : read_lit();
+        x++;
     }
 }
 
@@ -172,14 +447,14 @@ static void vertical(void)
 
 static void horizontal_diff(void)
 {
-    uint16_t i;
-    uint8_t c;
-    uint8_t d;
+    uint32_t i;
+    uint16_t c;
+    uint16_t d;
     uint8_t bit;
 
     i = width;
 
-    c = read_bits(8);
+    c = read_raw();
     *out_p++ = c;
 
     while (--i)             // must be pre-decrement
@@ -188,26 +463,26 @@ static void horizontal_diff(void)
 
         if (bit != 0)
         {
-            d = read_bits(8);
+            d = read_lit();
         }
 
-        c += d;
+        c = (c + d) & top;
         *out_p++ = c;
     }
 }
 
 // -----------------------------------------------------------------------
 
-static void v(uint8_t *q)
+static void v(uint16_t *q)
 {
-    uint16_t i;
-    uint8_t d;
+    uint32_t i;
+    uint16_t d;
     uint8_t bit;
 
     i = width;
 
-    d      = read_bits(8);
-    *out_p = (*q + d);
+    d      = read_raw();
+    *out_p = (*q + d) & top;
 
     out_p++;
     q++;
@@ -218,10 +493,10 @@ static void v(uint8_t *q)
 
         if (bit != 0)
         {
-            d = read_bits(8);
+            d = read_lit();
         }
 
-        *out_p = (*q + d);
+        *out_p = (*q + d) & top;
 
         out_p++;
         q++;
@@ -245,120 +520,689 @@ static void offset_diff(void)
 }
 
 // -----------------------------------------------------------------------
-// decompress all scan lines of image
+// cross channel differential decompression.  like vertical differential
+// with the same pixel of the channel before instead of the one above, but
+// each literal is how much the delta changed rather than the new delta
+
+static void cross_diff(void)
+{
+    uint32_t i;
+    uint16_t d;
+    uint16_t *q;
+
+    i = width;
+    q = ref + (out_p - plane_p);
+
+    d        = read_raw();
+    *out_p++ = (*q++ + d) & top;
+
+    while (--i)
+    {
+        if (read_bit() != 0)
+        {
+            d += read_lit();
+        }
+
+        *out_p++ = (*q++ + d) & top;
+    }
+}
+
+// -----------------------------------------------------------------------
+// Paeth, average and gradient differential decompression
+
+static inline void pd(tag_t tag)
+{
+    uint32_t i;
+    uint16_t d;
+    uint8_t bit;
+    uint16_t *q;
+
+    i = width;
+    q = (out_p - width);
+
+    d      = read_raw();    // first pixel is predicted from the one above
+    *out_p = (*q + d) & top;
+
+    out_p++;
+    q++;
+
+    while (--i)
+    {
+        bit = read_bit();
+
+        if (bit != 0)
+        {
+            d = read_lit();
+        }
+
+        *out_p = (predict(tag, out_p[-1], *q, q[-1], top) + d) & top;
+
+        out_p++;
+        q++;
+    }
+}
+
+// -----------------------------------------------------------------------
 
-static void sb_decompress(void)
+static void paeth_diff(void)     { pd(PAETH_DIFF);    }
+static void average_diff(void)   { pd(AVERAGE_DIFF);  }
+static void gradient_diff(void)  { pd(GRADIENT_DIFF); }
+
+// -----------------------------------------------------------------------
+// remember the method of each scan line so it can be graphed afterwards
+// (sbif -v, dsbif -v).  GRAPH_END goes after the last scan line of each
+// channel
+
+static void graph(uint8_t tag)
+{
+    tag_buff[num_tags++] = tag;
+}
+
+// -----------------------------------------------------------------------
+// decompress all scan lines of image.  fails on a tag that is not one of
+// the methods, which can only come from a corrupt file
+
+static int sb_decompress(uint16_t *dst)
 {
     tag_t tag;
-    uint16_t i;
+    uint32_t i;
+    uint32_t n;
+    double t;
 
-    out_p = out_buff;
+    out_p   = dst;
+    plane_p = dst;
     reset();
 
+    // in split mode the literals come after the flag bits, which are
+    // however long the four bytes in front of them say
+
+    if (split)
+    {
+        memcpy(&n, in_p, 4);
+
+        lit_p = in_p + 4 + n;
+        in_p += 4;
+    }
+
     i = height;
+    stats->rows += height;
 
     while (i--)
     {
-        tag = read_bits(3);
+        t   = sbif_now();
+        tag = read_bits(tag_bits);
+        k   = -1;
+
+        // anything that is not a method is a corrupt file, and so is a
+        // cross channel delta with no channel before it
+
+        if (((tag > CROSS_DIFF) && (tag != X_DIFF_RICE)) ||
+            (((tag == CROSS_DIFF) || (tag == X_DIFF_RICE)) && (ref == NULL)))
+        {
+            printf("Bad Tag %d\n", tag);
+            return -1;
+        }
+
+        stats->tries[tag]++;
+        stats->wins[channel][tag]++;
+
+        graph(tag);
+
+        // rice coded forms of the differential methods are followed by
+        // their k and otherwise decompress exactly like the originals
+
+        if (((tag >= H_DIFF_RICE) && (tag <= G_DIFF_RICE)) ||
+            (tag == X_DIFF_RICE))
+        {
+            k = read_bits(2);
+        }
 
         // decompress based on method specified in tag
-        // and graph decompression visually
 
-        // if the compression graph is different from what we produce here
-        // then either compression or decompression is broken.   this was
-        // actually a very helpful tool during development.  it also looks
-        // cool and scientifical !
+        switch ((k >= 0) ? tag - RICE : tag)
+        {
+            case HORIZONTAL:       horizontal();       break;
+            case VERTICAL:         vertical();         break;
+            case HORIZONTAL_DIFF:  horizontal_diff();  break;
+            case VERTICAL_DIFF:    vertical_diff();    break;
+            case OFFSET_DIFF:      offset_diff();      break;
+            case PAETH_DIFF:       paeth_diff();       break;
+            case AVERAGE_DIFF:     average_diff();     break;
+            case GRADIENT_DIFF:    gradient_diff();    break;
+            case REPEAT:           repeat(height - 1 - i); break;
+            case SHIFTED:          shifted();          break;
+            case CROSS_DIFF:       cross_diff();       break;
+            default:                                   break;
+        }
+
+        // in continuous mode the next scan line carries straight on from
+        // this one unless it starts a new segment
 
-        switch (tag)
+        if (!continuous || (i == 0) ||
+            (((height - i) % SEGMENT_ROWS) == 0))
         {
-            case HORIZONTAL:       printf("▬");  horizontal();       break;
-            case VERTICAL:         printf("▮");  vertical();         break;
-            case HORIZONTAL_DIFF:  printf("▭");  horizontal_diff();  break;
-            case VERTICAL_DIFF:    printf("▯");  vertical_diff();    break;
-            case OFFSET_DIFF:      printf("◈");  offset_diff();      break;
+            flush_bits();
         }
 
-        flush_bits();
+        stats->method[tag] += sbif_now() - t;
     }
+
+    in_p = split ? lit_p : in_p;
+
+    graph(GRAPH_END);
+
+    return 0;
 }
 
 // -----------------------------------------------------------------------
 
-static uint32_t check_header(void)
+static int check_header(size_t len)
 {
-    int n;
-
     sbif_header_t *header = (sbif_header_t *)in_buff;
 
+    if (len < sizeof(sbif_header_t))
+    {
+        printf("Bad File\n");
+        return -1;
+    }
+
     if (header->magic != (uint32_t)'FIBS')
     {
         printf("Bad Magic\n");
-        exit(0);
+        return -1;
+    }
+
+    if (header->version != SBIF_VERSION)
+    {
+        printf("Unsupported version %d\n", header->version);
+        return -1;
+    }
+
+    // every tile is at least a pixel, even those of an empty image, and
+    // none are bigger than the image
+
+    if ((header->tile_w == 0) || (header->tile_h == 0) ||
+        (header->tile_w > ((header->width  != 0) ? header->width  : 1)) ||
+        (header->tile_h > ((header->height != 0) ? header->height : 1)))
+    {
+        printf("Bad Tile Size\n");
+        return -1;
+    }
+
+    if ((header->tag_bits < 3) || (header->tag_bits > 5))
+    {
+        printf("Bad Tag Bits %d\n", header->tag_bits);
+        return -1;
+    }
+
+    if (header->mark8 == header->mark16)
+    {
+        printf("Bad Markers\n");
+        return -1;
+    }
+
+    if ((header->depth != 8) && (header->depth != 16))
+    {
+        printf("Bad Depth %d\n", header->depth);
+        return -1;
+    }
+
+    if ((header->color > COLOR_RGBA) ||
+        (header->channels != color_channels[header->color]) ||
+        (header->channels == 0))
+    {
+        printf("Bad Channels\n");
+        return -1;
+    }
+
+    head_size = sizeof(sbif_header_t) + (header->colors * header->channels);
+
+    if ((header->colors > 256) || (len < head_size) ||
+        ((header->colors != 0) && (header->depth != 8)))
+    {
+        printf("Bad Palette\n");
+        return -1;
+    }
+
+    image_w  = header->width;
+    image_h  = header->height;
+    tag_bits = header->tag_bits;
+    split    = header->flags & FLAG_SPLIT;
+    tile_w   = header->tile_w;
+    tile_h   = header->tile_h;
+    channels = header->channels;
+    color    = header->color;
+    depth    = header->depth;
+    bytes    = depth / 8;
+    colors   = header->colors;
+
+    continuous = header->flags & FLAG_CONTINUOUS;
+
+    mark8  = header->mark8;
+    mark16 = header->mark16;
+
+    // palette indices are only as many bits as it takes to count the
+    // colors
+
+    if (colors != 0)
+    {
+        for (depth = 1; (1 << depth) < colors; depth++)
+            ;
+
+        memset(palette, 0, sizeof(palette));
+        memcpy(palette, in_buff + sizeof(sbif_header_t), colors * channels);
     }
 
-    width  = header->width;
-    height = header->height;
+    top      = (1 << depth) - 1;
+    k_base   = (depth > 8) ? depth - 8 : 0;
 
-    return(width * height);
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+
+static uint32_t get32(uint8_t *p)
+{
+    uint32_t n;
+
+    memcpy(&n, p, 4);       // seek table entries are not aligned
+    return n;
+}
+
+// -----------------------------------------------------------------------
+// check the seek table and find out how big the biggest frame is once it
+// is decompressed.  an image that is not tiled is one frame with no seek
+// table after it
+
+static int read_seek_table(size_t file_size)
+{
+    uint32_t i;
+    uint64_t off;
+    uint8_t *p;
+
+    num_frames = ((image_w + tile_w - 1) / tile_w) *
+                 ((image_h + tile_h - 1) / tile_h);
+
+    off    = head_size;
+    seek_p = NULL;
+
+    if (num_frames == 1)
+    {
+        z_cap = ZSTD_getFrameContentSize(in_buff + off, file_size - off);
+
+        if (z_cap >= ZSTD_CONTENTSIZE_ERROR)
+        {
+            printf("Bad Frame\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    p = in_buff + file_size - SEEK_FOOTER;
+
+    if ((get32(p + 5) != SEEK_MAGIC) || (get32(p) != num_frames))
+    {
+        printf("Bad Seek Table\n");
+        return -1;
+    }
+
+    seek_p = p - (num_frames * 8);
+    z_cap  = 0;
+
+    for (i = 0; i != num_frames; i++)
+    {
+        p     = seek_p + (i * 8);
+        z_cap = (get32(p + 4) > z_cap) ? get32(p + 4) : z_cap;
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+// work out where each tiles zstd frame is in the file
+
+static void locate_frames(size_t file_size)
+{
+    uint32_t i;
+    uint64_t off;
+
+    off = head_size;
+
+    if (seek_p == NULL)
+    {
+        frame_off[0] = off;
+        frame_len[0] = file_size - off;
+        return;
+    }
+
+    for (i = 0; i != num_frames; i++)
+    {
+        frame_off[i] = off;
+        frame_len[i] = get32(seek_p + (i * 8));
+
+        off += frame_len[i];
+    }
+}
+
+// -----------------------------------------------------------------------
+// get every working buffer out of the arena
+
+static void get_buffers(void)
+{
+    size_t tiles;
+
+    // only the tiles that overlap the region get decompressed
+
+    tiles = (((rx + rw - 1) / tile_w) - (rx / tile_w) + 1) *
+            (((ry + rh - 1) / tile_h) - (ry / tile_h) + 1);
+
+    frame_off = carve(num_frames * 8);
+    frame_len = carve(num_frames * 4);
+    t_buff    = carve((size_t)tile_w * tile_h * 2 * sizeof(uint16_t));
+    z_buff    = carve(z_cap);
+
+    // a tag for every scan line of every channel of each of those tiles
+    // plus the GRAPH_END after each channel
+
+    tag_buff  = carve(tiles * (tile_h + 1) * 4);
+}
+
+// -----------------------------------------------------------------------
+
+void sbif_decode_free(void)
+{
+    free(arena);
+
+    arena      = NULL;
+    arena_size = 0;
 }
 
 // -----------------------------------------------------------------------
 
 static void zstd_decompress(void)
 {
-    unsigned long long const rSize = ZSTD_getFrameContentSize(in_p, z_size);
+    double t = sbif_now();
 
-    void* const rBuff = calloc(rSize, 1);
+    size_t const rSize = ZSTD_decompress(z_buff, z_cap, in_p, z_size);
 
-    size_t const dSize = ZSTD_decompress(z_buff, rSize, in_p, z_size);
+    stats->stage3 += sbif_now() - t;
+
+    stats->frames++;
+    stats->stage3_bytes  += z_size;
+    stats->stage12_bytes += rSize;
 }
 
 // -----------------------------------------------------------------------
+// copy one channel of the overlap into output channel c, or fill it with
+// 0xff (0xffff) if src is NULL.  indices are looked up in the palette
 
-void main(int argc, char **argv)
+static void copy_out(int c, uint16_t *src, uint32_t x, uint32_t y,
+    uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
 {
-    int n;
-    int size;
-    struct stat st;
-    clock_t start;              // time at start and end of compression
-    clock_t finish;
+    uint32_t i;
+    uint32_t j;
+    uint16_t n;
+    uint8_t *dst;
 
-    FILE *fp;
+    dst  = out_buff + out_chan[c];
+    dst += ((y + y0 - ry) * out_stride) + ((x + x0 - rx) * out_bpp);
 
-    fp = fopen(argv[1], "rb");
-    fstat(fileno(fp), &st);
+    for (i = y0; i != y1; i++)
+    {
+        for (j = 0; j != x1 - x0; j++)
+        {
+            n = (src == NULL)
+                ? (1 << (bytes * 8)) - 1
+                : src[((size_t)i * width) + x0 + j];
+            n = ((colors != 0) && (src != NULL))
+                ? palette[(n * channels) + out_src[c]]
+                : n;
+
+            (bytes == 1)
+                ? (dst[j * out_bpp] = n)
+                : (*(uint16_t *)&dst[j * out_bpp] = n);
+        }
+        dst += out_stride;
+    }
+}
+
+// -----------------------------------------------------------------------
+// decompress the tile at x, y and copy the part of it that overlaps the
+// region into each output channel
 
-    in_buff  = calloc(st.st_size, 1);
+static int decompress_tile(uint32_t x, uint32_t y)
+{
+    uint32_t n;
+    uint32_t x0, y0;        // the overlap, relative to the tile
+    uint32_t x1, y1;
+    uint8_t *dst;
+    uint16_t *buff;
+    int c;
+    double t0, t1;
 
-    n = fread(in_buff, 1, st.st_size, fp);
-    fclose(fp);
+    width  = image_w - x;   // tiles on the right and bottom edges of
+    height = image_h - y;   // the image can be smaller than the rest
 
-    size = check_header();
+    width  = (width  < tile_w) ? width  : tile_w;
+    height = (height < tile_h) ? height : tile_h;
 
-    out_buff = calloc(size * 4, 1);
-    z_buff   = calloc(size * 4, 1);
+    n = ((y / tile_h) * ((image_w + tile_w - 1) / tile_w)) + (x / tile_w);
 
-    in_p   = in_buff    + sizeof(sbif_header_t);
-    z_size = st.st_size - sizeof(sbif_header_t);
+    in_p   = in_buff + frame_off[n];
+    z_size = frame_len[n];
 
     zstd_decompress();
 
-    out_fp = fopen(argv[2], "wb");
+    x0 = (rx > x) ? rx - x : 0;
+    y0 = (ry > y) ? ry - y : 0;
+    x1 = ((rx + rw) < (x + width))  ? rx + rw - x : width;
+    y1 = ((ry + rh) < (y + height)) ? ry + rh - y : height;
+
+    in_p = z_buff;
+    t1   = sbif_now();
+
+    for (c = 0; c != 4; c++)
+    {
+        if (out_src[c] == OPAQUE)
+        {
+            copy_out(c, NULL, x, y, x0, y0, x1, y1);
+        }
+    }
+
+    stats->copy += sbif_now() - t1;
+
+    ref = NULL;
+
+    for (n = 0; n != out_channels; n++)
+    {
+        channel = n;
+
+        // a 16 bit tile that exactly spans the width of the region and is
+        // entirely within it can be decompressed straight into a planar or
+        // grey output, otherwise we have to copy out the overlap (narrowing
+        // or interleaving it if need be).  in both of those output channel
+        // n is image channel n.  either way it is left where it is for the
+        // next channel to refer to, so the two halves of t_buff take turns
+
+        t0 = sbif_now();
+
+        if ((x0 == 0) && (x1 == width) && (width == rw) && (y0 == 0) &&
+            (y1 == height) && (bytes == 2) && (out_bpp == 2) &&
+            (out_stride == (rw * 2)))
+        {
+            dst  = out_buff + out_chan[n];
+            dst += (y - ry) * out_stride;
+
+            if (sb_decompress((uint16_t *)dst) != 0)
+            {
+                return -1;
+            }
+
+            ref = (uint16_t *)dst;
+            stats->stage12 += sbif_now() - t0;
+            continue;
+        }
+
+        buff = t_buff + ((n & 1) * tile_w * tile_h);
+
+        if (sb_decompress(buff) != 0)
+        {
+            return -1;
+        }
+
+        ref = buff;
+        t1  = sbif_now();
+
+        // grey goes to red, green and blue and every channel of an
+        // indexed image comes from its one plane of indices
+
+        for (c = 0; c != 4; c++)
+        {
+            if ((colors != 0) ? (out_src[c] >= 0) : (out_src[c] == n))
+            {
+                copy_out(c, buff, x, y, x0, y0, x1, y1);
+            }
+        }
+
+        stats->stage12 += t1 - t0;
+        stats->copy    += sbif_now() - t1;
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+// get the dimensions and number of channels of the image in a compressed
+// file
+
+int sbif_info(uint8_t *in, size_t len, uint32_t *w, uint32_t *h,
+    int *c, int *d)
+{
+    in_buff = in;
+
+    if (check_header(len) != 0)
+    {
+        return -1;
+    }
+
+    *w = image_w;
+    *h = image_h;
+    *c = channels;
+    *d = bytes * 8;
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+// decompress the w x h region at x, y of a compressed file.  each channel
+// of the region is written to out one after the other
+
+int sbif_decode(uint8_t *in, size_t len, uint8_t *out,
+    int64_t x, int64_t y, int64_t w, int64_t h, sbif_stats_t *s)
+{
+    uint32_t iw, ih;
+    int c, d;
+
+    if (sbif_info(in, len, &iw, &ih, &c, &d) != 0)
+    {
+        return -1;
+    }
 
-    start = clock();
+    return sbif_decode_pixels(in, len, out, w * (d / 8), SBIF_PLANAR,
+                              x, y, w, h, s);
+}
 
-    in_p  = z_buff;
-    out_p = out_buff;
+// -----------------------------------------------------------------------
+// decompress the w x h region at x, y of a compressed file into pixels of
+// the given format, stride bytes per scan line
+
+int sbif_decode_pixels(uint8_t *in, size_t len, uint8_t *out,
+    size_t stride, sbif_format_t format, int64_t x, int64_t y,
+    int64_t w, int64_t h, sbif_stats_t *s)
+{
+    int64_t tx, ty;
+    int n;
+
+    in_buff  = in;
+    out_buff = out;
+    stats    = s;
+
+    memset(stats, 0, sizeof(*stats));
+    num_tags = 0;
+
+    if ((check_header(len) != 0) || (read_seek_table(len) != 0))
+    {
+        return -1;
+    }
+
+    if ((unsigned)format > SBIF_GREY_ALPHA)
+    {
+        printf("Bad Format\n");
+        return -1;
+    }
+
+    if ((x < 0) || (y < 0) || (w <= 0) || (h <= 0) ||
+        ((x + w) > image_w) || ((y + h) > image_h))
+    {
+        printf("Region is not within the %ux%u image\n", image_w, image_h);
+        return -1;
+    }
+
+    rx = x;  ry = y;
+    rw = w;  rh = h;
+
+    stats->pixels = w * h;
+
+    out_stride   = stride;
+    out_bpp      = format_bpp[format] * bytes;
+    out_channels = 0;
+
+    // planar is each channel the image has, the rest take what they want
+    // from the channels the image has.  only channels up to the last one
+    // that is wanted get decompressed
 
     for (n = 0; n != 4; n++)
     {
-        sb_decompress();
-        printf("\n\n");
-        fwrite(out_buff, size, 1, out_fp);
+        out_chan[n] = layouts[format][n] * bytes;
+        out_src[n]  = (layouts[format][n] < 0) ? UNUSED : sources[color][n];
+
+        if (format == SBIF_PLANAR)
+        {
+            out_chan[n] = n * stride * h;
+            out_src[n]  = (n < channels) ? n : UNUSED;
+        }
+
+        out_channels = (out_src[n] >= out_channels)
+            ? out_src[n] + 1 : out_channels;
+    }
+
+    out_channels = (colors != 0) ? (out_channels != 0) : out_channels;
+
+    arena_used = 0;
+
+    get_buffers();          // first time round just sizes the arena
+    arena_reserve(arena_used);
+    get_buffers();
+
+    locate_frames(len);
+
+    // only the tiles that overlap the region are decompressed
+
+    for (ty = ry - (ry % tile_h); ty < (ry + rh); ty += tile_h)
+    {
+        for (tx = rx - (rx % tile_w); tx < (rx + rw); tx += tile_w)
+        {
+            if (decompress_tile(tx, ty) != 0)
+            {
+                return -1;
+            }
+        }
     }
 
-    finish = clock();
-    printf("%dms\n", (int)(finish - start) / 1000);
+    stats->tags     = tag_buff;
+    stats->num_tags = num_tags;
+
+    return 0;
 }
 
 // =======================================================================
@@ -0,0 +1,251 @@
+// dsbif_cli.c The SOMETIMES better image format decompressor
+// -----------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "sbif.h"
+
+// -----------------------------------------------------------------------
+
+uint32_t width;             // dimensions of the whole image
+uint32_t height;
+int channels;               // and how many channels it has
+int depth;                  // of 8 or 16 bits each
+
+int64_t rx, ry;             // the region of the image to decompress
+int64_t rw, rh;             // (dsbif -c or -r), the whole image by default
+
+uint8_t *in_buff;
+uint8_t *out_buff;
+
+sbif_format_t format = SBIF_PLANAR; // dsbif -f
+size_t stride;              // bytes per scan line of the output
+int planes;                 // how many of those, channels if planar
+
+const char *format_name[6] =
+{
+    "rgba", "bgra", "rgb", "grey", "planar", "greya"
+};
+
+FILE *out_fp;
+
+sbif_stats_t stats;
+
+// the name each method goes by in --stats output
+
+const char *tag_name[NUM_TAGS] =
+{
+    "horizontal", "vertical", "horizontal_diff", "vertical_diff",
+    "offset_diff", "paeth_diff", "average_diff", "gradient_diff",
+    "repeat", "shifted", "h_diff_rice", "v_diff_rice",
+    "o_diff_rice", "p_diff_rice", "a_diff_rice", "g_diff_rice",
+    "cross_diff", "", "", "", "", "", "", "",
+    "x_diff_rice", "", "", "", "", "", "", ""
+};
+
+int verbose;                // dsbif -v graphs each scan lines method
+int show_stats;             // dsbif --stats, to stats_file or stdout
+char *stats_file;
+
+struct option long_opts[] =
+{
+    { "stats", optional_argument, NULL, 's' },
+    { NULL, 0, NULL, 0 }
+};
+
+// -----------------------------------------------------------------------
+// the count for tag t in each color channel as a json array
+
+static void write_rgba(FILE *fp, char *name, uint64_t n[][NUM_TAGS], tag_t t)
+{
+    fprintf(fp, ", \"%s\": [ %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %"
+                PRIu64 " ]", name, n[0][t], n[1][t], n[2][t], n[3][t]);
+}
+
+// -----------------------------------------------------------------------
+// everything in stats as json
+
+static void write_stats(char *infile)
+{
+    FILE *fp;
+    tag_t t;
+    char *sep = "";
+
+    fp = (stats_file != NULL) ? fopen(stats_file, "w") : stdout;
+
+    fprintf(fp, "{\n  \"file\": \"%s\", \"width\": %u, \"height\": %u,\n"
+                "  \"region\": [ %" PRId64 ", %" PRId64 ", %" PRId64 ", %"
+                PRId64 " ],\n", infile, width, height, rx, ry, rw, rh);
+
+    fprintf(fp, "  \"ms\": { \"read\": %.3f, \"stage3\": %.3f, "
+                "\"stage12\": %.3f, \"copy\": %.3f, \"write\": %.3f, "
+                "\"total\": %.3f },\n", stats.load, stats.stage3,
+            stats.stage12, stats.copy, stats.write, stats.total);
+
+    fprintf(fp, "  \"methods\": {");
+
+    for (t = HORIZONTAL; t != NUM_TAGS; t++)
+    {
+        if (stats.tries[t] != 0)
+        {
+            fprintf(fp, "%s\n    \"%s\": { \"rows\": %" PRIu64 ", "
+                        "\"ms\": %.3f", sep, tag_name[t], stats.tries[t],
+                    stats.method[t]);
+
+            write_rgba(fp, "wins", stats.wins, t);
+
+            fprintf(fp, " }");
+            sep = ",";
+        }
+    }
+
+    fprintf(fp, "\n  },\n  \"pixels\": %" PRIu64 ", \"rows\": %" PRIu64 ", "
+                "\"frames\": %" PRIu64 ",\n", stats.pixels, stats.rows,
+            stats.frames);
+
+    fprintf(fp, "  \"rle\": { \"mark8\": %" PRIu64 ", \"mark16\": %" PRIu64
+                ", \"saved\": %" PRId64 " },\n", stats.mark8, stats.mark16,
+            stats.rle_saved);
+
+    fprintf(fp, "  \"ratio\": { \"stage3\": %.4f },\n",
+            (double)stats.stage12_bytes / stats.stage3_bytes);
+
+    fprintf(fp, "  \"bytes\": { \"stage3\": %" PRIu64 ", \"stage12\": %"
+                PRIu64 ", \"raw\": %" PRIu64 " }\n}\n", stats.stage3_bytes,
+            stats.stage12_bytes, stats.pixels * channels * (depth / 8));
+
+    (fp != stdout) ? fclose(fp) : fflush(fp);
+}
+
+// -----------------------------------------------------------------------
+
+void main(int argc, char **argv)
+{
+    int n;
+    int opt;
+    struct stat st;
+    double start;
+    double load;
+
+    FILE *fp;
+
+    rw = -1;
+
+    while ((opt = getopt_long(argc, argv, "c:r:f:v", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                n = sscanf(optarg, "%" SCNd64 ",%" SCNd64 ",%" SCNd64 ",%" SCNd64,
+                           &rx, &ry, &rw, &rh);
+                n = (n == 4);
+                break;
+
+            case 'r':       // rows y0 up to but not including y1
+                n   = sscanf(optarg, "%" SCNd64 ":%" SCNd64, &ry, &rh);
+                n   = (n == 2);
+                rh -= ry;
+                rw  = -2;
+                break;
+
+            case 'f':
+                for (n = 0; (n != 6) && strcmp(optarg, format_name[n]); n++)
+                    ;
+                format = n;
+                n      = (n != 6);
+                break;
+
+            case 'v':
+                n       = 1;
+                verbose = 1;
+                break;
+
+            case 's':
+                n          = 1;
+                show_stats = 1;
+                stats_file = optarg;
+                break;
+
+            default:
+                n = 0;
+        }
+
+        if (n == 0)
+        {
+            printf("usage: dsbif [-v] [-c x,y,w,h | -r y0:y1] "
+                   "[-f rgba|bgra|rgb|grey|greya|planar] [--stats[=file]] "
+                   "infile.sbz outfile.raw\n");
+            exit(0);
+        }
+    }
+
+    start = sbif_now();
+
+    fp = fopen(argv[optind], "rb");
+    fstat(fileno(fp), &st);
+
+    in_buff  = malloc(st.st_size);
+
+    n = fread(in_buff, 1, st.st_size, fp);
+    fclose(fp);
+
+    load = sbif_now() - start;
+
+    if (sbif_info(in_buff, st.st_size, &width, &height, &channels,
+                  &depth) != 0)
+    {
+        exit(0);
+    }
+
+    // no region is the same thing as a region the size of the image
+    // and a range of rows is a region the width of the image
+
+    rh = (rw == -1) ? height : rh;
+    rw = (rw <  0)  ? width  : rw;
+
+    // planar output is each of the channels of the image rw x rh one after
+    // the other, the rest are rw pixels per scan line
+
+    stride   = (rw > 0) ? rw * format_bpp[format] * (depth / 8) : 0;
+    planes   = (format == SBIF_PLANAR) ? channels : 1;
+    out_buff = malloc(((rw > 0) && (rh > 0)) ? stride * rh * planes : 1);
+
+    start = sbif_now();
+
+    if (sbif_decode_pixels(in_buff, st.st_size, out_buff, stride, format,
+                           rx, ry, rw, rh, &stats) != 0)
+    {
+        exit(0);
+    }
+
+    stats.total = sbif_now() - start;
+    stats.load  = load;
+    start       = sbif_now();
+
+    out_fp = fopen(argv[optind + 1], "wb");
+    fwrite(out_buff, stride * rh, planes, out_fp);
+    fclose(out_fp);
+
+    stats.write = sbif_now() - start;
+
+    if (verbose)
+    {
+        sbif_graph(stdout, &stats);
+    }
+
+    printf("%dms\n", (int)stats.total);
+
+    if (show_stats)
+    {
+        write_stats(argv[optind]);
+    }
+}
+
+// =======================================================================
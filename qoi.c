@@ -0,0 +1,266 @@
+// qoi.c     - The Quite OK Image format, for benchmarking sbif against
+// -----------------------------------------------------------------------
+
+// written from the QOI specification (qoiformat.org/qoi-specification.pdf)
+// so that the benchmark has no other dependencies.  only 4 channel RGBA
+// images are produced, which is all the benchmark needs
+
+// this is NOT the reference implementation (qoi.h by Dominic Szablewski)
+// and has had none of its tuning, so the files should be the same size
+// but the times the benchmark shows for it are this code's and not QOI's
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qoi.h"
+
+// -----------------------------------------------------------------------
+
+#define QOI_OP_INDEX  (0x00)    // 00xxxxxx
+#define QOI_OP_DIFF   (0x40)    // 01xxxxxx
+#define QOI_OP_LUMA   (0x80)    // 10xxxxxx
+#define QOI_OP_RUN    (0xc0)    // 11xxxxxx
+#define QOI_OP_RGB    (0xfe)
+#define QOI_OP_RGBA   (0xff)
+
+#define QOI_HEADER    (14)
+#define QOI_PADDING   (8)       // seven 0x00 bytes and a 0x01
+
+// -----------------------------------------------------------------------
+
+typedef struct
+{
+    uint8_t r, g, b, a;
+} px_t;
+
+// -----------------------------------------------------------------------
+
+static int hash(px_t p)
+{
+    return ((p.r * 3) + (p.g * 5) + (p.b * 7) + (p.a * 11)) % 64;
+}
+
+// -----------------------------------------------------------------------
+
+static uint8_t *put32(uint8_t *p, uint32_t n)
+{
+    *p++ = (n >> 24);       // qoi is big endian
+    *p++ = (n >> 16);
+    *p++ = (n >> 8);
+    *p++ = n;
+
+    return p;
+}
+
+static uint32_t get32(uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// -----------------------------------------------------------------------
+
+uint8_t *qoi_encode(uint8_t *rgba, uint32_t w, uint32_t h, size_t *len)
+{
+    uint8_t *out;
+    uint8_t *p;
+    px_t index[64];
+    px_t px;
+    px_t prev;
+    size_t n;
+    size_t i;
+    int run;
+    int vr, vg, vb;
+
+    n   = (size_t)w * h;
+    out = malloc(QOI_HEADER + (n * 5) + QOI_PADDING);
+
+    if (out == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(out, "qoif", 4);
+    p = put32(out + 4, w);
+    p = put32(p, h);
+
+    *p++ = 4;               // channels
+    *p++ = 0;               // sRGB with linear alpha
+
+    memset(index, 0, sizeof(index));
+
+    prev.r = prev.g = prev.b = 0;
+    prev.a = 255;
+    run    = 0;
+
+    for (i = 0; i != n; i++)
+    {
+        memcpy(&px, &rgba[i * 4], 4);
+
+        if (memcmp(&px, &prev, 4) == 0)
+        {
+            run++;
+
+            if ((run == 62) || (i == (n - 1)))
+            {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run  = 0;
+            }
+            continue;
+        }
+
+        if (run != 0)
+        {
+            *p++ = QOI_OP_RUN | (run - 1);
+            run  = 0;
+        }
+
+        if (memcmp(&index[hash(px)], &px, 4) == 0)
+        {
+            *p++ = QOI_OP_INDEX | hash(px);
+        }
+        else
+        {
+            index[hash(px)] = px;
+
+            if (px.a == prev.a)
+            {
+                vr = (int8_t)(px.r - prev.r);
+                vg = (int8_t)(px.g - prev.g);
+                vb = (int8_t)(px.b - prev.b);
+
+                if ((vr > -3) && (vr < 2) && (vg > -3) && (vg < 2) &&
+                    (vb > -3) && (vb < 2))
+                {
+                    *p++ = QOI_OP_DIFF | ((vr + 2) << 4) |
+                           ((vg + 2) << 2) | (vb + 2);
+                }
+                else if (((vr - vg) > -9) && ((vr - vg) < 8) &&
+                         (vg > -33) && (vg < 32) &&
+                         ((vb - vg) > -9) && ((vb - vg) < 8))
+                {
+                    *p++ = QOI_OP_LUMA | (vg + 32);
+                    *p++ = ((vr - vg + 8) << 4) | (vb - vg + 8);
+                }
+                else
+                {
+                    *p++ = QOI_OP_RGB;
+                    *p++ = px.r;
+                    *p++ = px.g;
+                    *p++ = px.b;
+                }
+            }
+            else
+            {
+                *p++ = QOI_OP_RGBA;
+                memcpy(p, &px, 4);
+                p += 4;
+            }
+        }
+
+        prev = px;
+    }
+
+    memset(p, 0, QOI_PADDING - 1);
+    p += QOI_PADDING - 1;
+    *p++ = 1;
+
+    *len = p - out;
+    return out;
+}
+
+// -----------------------------------------------------------------------
+
+uint8_t *qoi_decode(uint8_t *in, size_t len, uint32_t *w, uint32_t *h)
+{
+    uint8_t *out;
+    uint8_t *p;
+    uint8_t *end;
+    px_t index[64];
+    px_t px;
+    size_t n;
+    size_t i;
+    int run;
+    int b1, b2;
+    int vg;
+
+    if ((len < QOI_HEADER + QOI_PADDING) || (memcmp(in, "qoif", 4) != 0))
+    {
+        return NULL;
+    }
+
+    *w  = get32(in + 4);
+    *h  = get32(in + 8);
+    n   = (size_t)*w * *h;
+    out = malloc(n * 4);
+
+    if (out == NULL)
+    {
+        return NULL;
+    }
+
+    p   = in + QOI_HEADER;
+    end = in + len - QOI_PADDING;
+
+    memset(index, 0, sizeof(index));
+
+    px.r = px.g = px.b = 0;
+    px.a = 255;
+    run  = 0;
+
+    for (i = 0; i != n; i++)
+    {
+        if (run != 0)
+        {
+            run--;
+        }
+        else if (p < end)
+        {
+            b1 = *p++;
+
+            if (b1 == QOI_OP_RGB)
+            {
+                px.r = *p++;
+                px.g = *p++;
+                px.b = *p++;
+            }
+            else if (b1 == QOI_OP_RGBA)
+            {
+                memcpy(&px, p, 4);
+                p += 4;
+            }
+            else switch (b1 & 0xc0)
+            {
+                case QOI_OP_INDEX:
+                    px = index[b1];
+                    break;
+
+                case QOI_OP_DIFF:
+                    px.r += ((b1 >> 4) & 3) - 2;
+                    px.g += ((b1 >> 2) & 3) - 2;
+                    px.b += (b1 & 3) - 2;
+                    break;
+
+                case QOI_OP_LUMA:
+                    b2    = *p++;
+                    vg    = (b1 & 0x3f) - 32;
+                    px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                    px.g += vg;
+                    px.b += vg - 8 + (b2 & 0x0f);
+                    break;
+
+                case QOI_OP_RUN:
+                    run = (b1 & 0x3f);
+                    break;
+            }
+
+            index[hash(px)] = px;
+        }
+
+        memcpy(&out[i * 4], &px, 4);
+    }
+
+    return out;
+}
+
+// =======================================================================
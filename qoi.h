@@ -0,0 +1,13 @@
+// qoi.h     - The Quite OK Image format, for benchmarking sbif against
+// -----------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+
+// -----------------------------------------------------------------------
+// both return a malloc()ed buffer or NULL.  the data is always RGBA
+
+uint8_t *qoi_encode(uint8_t *rgba, uint32_t w, uint32_t h, size_t *len);
+uint8_t *qoi_decode(uint8_t *in, size_t len, uint32_t *w, uint32_t *h);
+
+// =======================================================================
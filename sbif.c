@@ -4,39 +4,86 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <zstd.h>
 
 #include "sbif.h"
-#include "lodepng.h"        // makes the build 487658265295 times slower
 
 // -----------------------------------------------------------------------
-// global variables because im lazy and ... why not?
+// images bigger than this many pixels are compressed in bands unless
+// told otherwise so the buffers we need stay a sensible size
+
+#define BAND_PIXELS (1 << 24)
+
+// -----------------------------------------------------------------------
+// a channel is only split up between threads if every thread gets at
+// least this many pixels of it, otherwise starting them costs more than
+// it saves
 
-// the RGBA data is separated out into their respective buffers
+#define THREAD_PIXELS (1 << 16)
+#define MAX_THREADS   64
 
-uint8_t *r_buff;            // all red   pixels of image
-uint8_t *g_buff;            // all green pixels of image
-uint8_t *b_buff;            // all blue  pixels of image
-uint8_t *a_buff;            // all alpha bytes  of image
+// -----------------------------------------------------------------------
+// global variables because im lazy and ... why not?
+
+// the scan lines of a channel can be split up between threads (sbif -j)
+// so everything that is used while compressing a scan line is __thread,
+// each thread gets its own copy.  the rest is only ever touched by the
+// thread that called sbif_encode_pixels()
 
 // each method is tried one at a time and the method producing the
 // smallest results is chosen.
 
-uint8_t *h_comp_buff;       // compression try buffers for each method.
-uint8_t *v_comp_buff;
-uint8_t *h_diff_buff;
-uint8_t *v_diff_buff;
-uint8_t *z_diff_buff;       // offset vertical compression buffer
+static __thread uint8_t *try_buff[NUM_TAGS]; // try buffers for each method
+static __thread uint32_t try_len[NUM_TAGS]; // their lengths, -1 if not tried
+static __thread uint32_t try_lits[NUM_TAGS]; // and of their literals, split
+static __thread uint32_t try_bits[NUM_TAGS]; // and in bits, continuous mode
+static __thread uint64_t try_score[NUM_TAGS]; // estimated cost, entropy mode
+
+static __thread uint32_t out_len;   // length of current try
+static __thread uint8_t *lit_p;     // where its next literal goes, split
+static __thread uint32_t mark8;     // runs written by current try and what
+static __thread uint32_t mark16;    // they saved, kept per try so only the
+static __thread int32_t saved;      // runs of the winning try get counted
 
-uint32_t h_comp_len;        // cursors for each of the above
-uint32_t v_comp_len;
-uint32_t h_diff_len;
-uint32_t v_diff_len;
-uint32_t z_diff_len;
+static __thread uint32_t try_mark8[NUM_TAGS];
+static __thread uint32_t try_mark16[NUM_TAGS];
+static __thread int32_t try_saved[NUM_TAGS];
+static __thread uint64_t best;      // best length of all tries
 
-uint32_t out_len;           // length of current try
-uint32_t best;              // best length of all tries
+static int max_mode;        // sbif -m also tries the predictor methods
+static int rice_mode;       // sbif -r also tries rice coded literals
+static int shift_mode;      // sbif -s also tries shifted vertical copies
+static int cross_mode;      // sbif -x also tries deltas across channels
+static int split_mode;      // sbif -l puts literals in a stream of their own
+static int continuous;      // sbif -c carries the bits on across scan lines
+static int entropy_mode;    // sbif -e picks tries by what zstd might make
+
+static uint8_t tag_bits = 3; // 4 in rice, shift or repeat mode, 5 in cross
+
+// the REPEAT tag needs four bit tags.  sbif -u asks for repeats of the
+// scan line above and sbif -k for copies of any scan line before it as
+// well, and any mode that already pays for a fourth tag bit gets both
+
+static int repeats;         // scan lines the same as the one above
+static int copies;          // and the same as any earlier one
+
+static uint8_t tried[NUM_TAGS]; // tags these options can ever try
+
+static int depth;           // bits per literal, 8 or 16 or index bits
+static int bytes;           // bytes per channel of the pixels, 1 or 2
+static uint16_t top;        // the biggest a channel can be, 0xff or 0xffff
+static uint8_t k_base;      // added to every k, 8 for 16 bit channels
+
+// while a differential method writes its 8 bit literals we also add up
+// what they would have cost rice coded with each k so that its rice
+// coded try only has to be done once, with the cheapest k
+
+static __thread int8_t k = -1;      // rice parameter of current try or -1
+static __thread uint32_t k_cost[4]; // cost in bits of current tries literals
+static __thread uint8_t best_k[NUM_TAGS]; // cheapest k for each diff try
 
 // as data is compressed into individual bits those bits are staged
 // here until a complete byte is compiled.  this byte is then
@@ -45,35 +92,185 @@ uint32_t best;              // best length of all tries
 // old run is written out to the output buffer and a new run is
 // started with length 1
 
-uint8_t bit_cache;          // bit data output staging area
-uint8_t num_bits;           // how many bits are in the cache so far
+static __thread uint8_t bit_cache; // bit data output staging area
+static __thread uint8_t num_bits;  // how many bits are in the cache so far
+
+static __thread uint32_t run;       // current output data run length
+static __thread uint8_t rle;        // run data
 
-uint16_t run;               // current output data run length
-uint8_t rle;                // run data
+// in entropy mode every byte the channels before this one wrote is counted
+// and each try is scored by what its bytes would cost if every byte value
+// cost what it has so far, in 1/256ths of a bit.  the literals of split
+// mode are counted separately.  only the threads of the next channel use
+// them so the file still comes out the same however many there are
 
-char *infile;               // input file name
-char *outfile;              // output file name
+static uint64_t out_hist[256];
+static uint64_t lit_hist[256];
+static uint16_t out_cost[256];
+static uint16_t lit_cost[256];
 
-int width;                  // dimensions of image being compressed
-int height;
-int size;                   // with * height
+static uint8_t esc8 = MARK8;    // the bytes that start a run with an 8 bit
+static uint8_t esc16 = MARK16;  // count and a longer one in this image
+
+static __thread uint8_t stream_cache; // continuous mode bits of the winning
+static __thread uint8_t stream_bits;  // tries not yet run length encoded
+
+static unsigned image_w;    // dimensions of image being compressed
+static unsigned image_h;
+static size_t size;         // with * height
+
+static uint32_t width;      // dimensions of the tile being compressed
+static uint32_t height;     // which is the whole image unless tiled
+
+static int64_t tile_w;      // size of each tile (sbif -t), zero if none
+static int64_t tile_h;      // bands (sbif -b) are tiles as wide as the image
+
+// each color channel of the current tile is separated out of the RGBA
+// data into its own buffer just before it is compressed.  8 bit channels
+// are widened so every method only has to deal with one kind of scan line
+
+static uint16_t *t_buff;    // two channels, this one and the one before
+static uint16_t *ref;       // the one before, NULL for the first channel
+
+static uint32_t *seek_table; // compressed and uncompressed size of each
+static uint32_t num_frames; // tiles zstd frame
+
+static __thread uint16_t *in_p;    // current position within scan line
+static __thread uint8_t *out_p;    // current position within try buffer
+
+static FILE *out_fp;        // end result written out to this file
+
+static uint8_t *pixels;     // the image being compressed
+static size_t stride;       // bytes from one scan line to the next
+static uint8_t bpp;         // bytes per pixel
+static size_t plane;        // bytes from one channel to the next, planar
+static const int8_t *layout; // where each channel is within a pixel
+
+static int channels;        // how many channels the image has
+static uint8_t color;       // and which, as a PNG color type
+static int planes;          // how many get compressed, 1 if indexed
+
+// palette mode compresses one plane of indices into the palette, which is
+// written out after the header.  indices are only as many bits as it
+// takes to count the colors
+
+static uint8_t *palette;
+static int colors;          // zero if not indexed
+static sbif_format_t palette_format;
+
+// the offset of each channel within a pixel of each sbif_format_t
+
+static const int8_t layouts[7][4] =
+{
+    {  0,  1,  2,  3 },     // SBIF_RGBA
+    {  2,  1,  0,  3 },     // SBIF_BGRA
+    {  0,  1,  2       },   // SBIF_RGB
+    {  0               },   // SBIF_GREY
+    {  0,  0,  0,  0 },     // SBIF_PLANAR, plane apart
+    {  0,  1           },   // SBIF_GREY_ALPHA
+    {  0               }    // SBIF_INDEXED
+};
+
+static const uint8_t format_channels[6] = { 4, 4, 3, 1, 4, 2 };
+
+static const uint8_t format_color[6] =
+{
+    COLOR_RGBA, COLOR_RGBA, COLOR_RGB, COLOR_GREY, COLOR_RGBA,
+    COLOR_GREY_ALPHA
+};
 
-uint8_t *in_p;              // current position within input buffer
-uint8_t *out_p;             // current position within final output buffer
+static sbif_stats_t *stats; // where to add up what each stage costs
+static int channel;         // which of RGBA is being compressed
 
-FILE *out_fp;               // end result written out to this file
+static uint8_t *tag_buff;   // the method of every scan line so far
+static size_t num_tags;
+static __thread double t_try;      // when the current try was started
 
-uint8_t *png_image;         // decoding PNG should be simpler
+// each thread compresses a range of the scan lines of a channel into an
+// output buffer of its own, adding up its own stats and method tags as it
+// goes.  once they are all done the outputs are joined back up in order
+// so the file comes out exactly the same however many threads there are
 
-clock_t start;              // time at start and end of compression
-clock_t finish;
+typedef struct
+{
+    uint16_t *p;            // the channel
+    uint32_t y0, y1;        // scan lines y0 up to y1 of it
+    uint8_t *try_buff[NUM_TAGS];
+    uint8_t *out;           // the winning try of every scan line
+    size_t out_size;
+    uint8_t *tags;          // and its method
+    size_t num_tags;
+    uint8_t *lit_buff[NUM_TAGS]; // split mode literals of each try
+    uint8_t *lits;          // and of every winning try
+    size_t lits_size;
+    sbif_stats_t stats;     // methods, wins and runs only
+} job_t;
+
+static job_t jobs[MAX_THREADS];
+static int threads;         // how many of them there can be
+static __thread job_t *job; // the one this thread is doing
+
+// with four bit tags a scan line the same as any earlier one in the
+// channel is copied from it.  they are found before the threads start
+// by hashing every scan line into an open addressed table
+
+static uint32_t *same;      // earliest scan line each one is the same as
+static uint32_t *row_hash;  // scan line + 1 of each hash, zero if empty
+static size_t hash_size;    // a power of two, at least twice tile_h
 
 // zstd encoding of the data my algorithms produce was always intended
 // but it was only added when I had proved my algorithms were working
 // zstd encoding is considered stage 3 of the process
 
-uint8_t *s3_buff;           // stage 3 zstd compression input buffer
-uint32_t s3_size;           // how much data we have stuffed in there
+static uint8_t *s3_buff;    // stage 3 zstd compression input buffer
+static size_t s3_size;      // how much data we have stuffed in there
+
+static uint8_t *z_out_buff; // stage 3 output for one tile
+static size_t z_out_size;
+
+// the run markers are picked from the first tile, these are where the
+// runs and the split mode literals of each of its channels are
+
+static size_t rle_at[4];
+static size_t rle_end[4];
+static size_t lits_end[4];
+
+// -----------------------------------------------------------------------
+// every working buffer is carved out of one arena.  it only ever grows so
+// compressing a batch of images of the same size allocates exactly once.
+// nothing in it is zeroed, every buffer is written before it is read
+
+static uint8_t *arena;
+static size_t arena_size;
+static size_t arena_used;
+
+// -----------------------------------------------------------------------
+// returns NULL when there is no room, which only happens on the first
+// pass where we are just adding up how much room is needed
+
+static void *carve(size_t n)
+{
+    uint8_t *p;
+
+    p = ((arena_used + n) <= arena_size) ? &arena[arena_used] : NULL;
+    arena_used += ARENA_ALIGN(n);
+
+    return p;
+}
+
+// -----------------------------------------------------------------------
+
+static void arena_reserve(size_t n)
+{
+    if (n > arena_size)
+    {
+        free(arena);
+
+        arena      = malloc(n);
+        arena_size = n;
+    }
+    arena_used = 0;
+}
 
 // -----------------------------------------------------------------------
 // reset encoding engine for new data
@@ -84,14 +281,20 @@ static void reset(void)
     bit_cache = 0;
     num_bits  = 0;
     run       = 0;
+
+    stream_cache = 0;
+    stream_bits  = 0;
 }
 
 // -----------------------------------------------------------------------
-// write rle run to output buffer with an 8 or 16 bit run length
+// write rle run to output buffer with an 8 bit or a variable length run
+// length
 
-void write_run(void)
+static void write_run(void)
 {
-    // run length can be anywhere from 0x0001 to 0xffff
+    uint8_t n;
+
+    // run length can be anywhere from 1 to 0xffffffff
 
     if (run < 3)
     {
@@ -100,7 +303,7 @@ void write_run(void)
         // to write a run with an 8 run count of 1 or 2 (i.e. data that is
         // the same as the RLE markers need to be escaped)
 
-        if ((rle != MARK8) && (rle != MARK16))
+        if ((rle != esc8) && (rle != esc16))
         {
             while (run)
             {
@@ -116,59 +319,91 @@ void write_run(void)
 
     if (run < 0x100)
     {
-        *out_p++ = MARK8;
+        *out_p++ = esc8;
         *out_p++ = (uint8_t)(run & 0xff);
         *out_p++ = rle;
 
         out_len += 3;
+        saved   += (int32_t)run - 3;
+        mark8++;
     }
     else
     {
-        *out_p++ = MARK16;
-        *out_p++ = (uint8_t)(run >> 8);
-        *out_p++ = (uint8_t)(run & 0xff);
-        *out_p++ = rle;
+        // seven bits of the count at a time, most significant first,
+        // with the top bit set on all but the last
+
+        for (n = 28; (run >> n) == 0; n -= 7)
+            ;
+
+        *out_p++ = esc16;
+        out_len += (n / 7) + 3;
+        saved   += run - ((n / 7) + 3);
+        mark16++;
+
+        for (; n != 0; n -= 7)
+        {
+            *out_p++ = 0x80 | ((run >> n) & 0x7f);
+        }
 
-        out_len += 4;
+        *out_p++ = run & 0x7f;
+        *out_p++ = rle;
     }
 
     run = 0;                // run is zero here too!
 }
 
+// -----------------------------------------------------------------------
+// run length encode one more byte of output
+
+static void put_byte(uint8_t c)
+{
+    // if the byte is not the same as the current run write that run out
+    // and start a new one.  same goes if the run is as long as a run can
+    // be
+
+    if ((c != rle) || (run == UINT32_MAX))
+    {
+        // do we have a previous run that we need to write out?
+
+        if (run != 0)
+        {
+            write_run();
+        }
+
+        // run will be zero here, set new rle value and set the new run
+        // length to one
+
+        rle = c;
+    }
+
+    // either increments the current run length or sets it to 1
+
+    run++;
+}
+
 // -----------------------------------------------------------------------
 // write a single bit out to the bit cache
 
-void write_bit(uint8_t bit)
+static void write_bit(uint8_t bit)
 {
     bit_cache <<= 1;
     bit_cache |= (bit) ? 1 : 0;
     num_bits++;
 
-    // if the cache is full...
+    // if the cache is full...  in continuous mode tries are not run
+    // length encoded, that only happens once the winner is picked
 
     if (num_bits == 8)
     {
-        // if the cached bits are not the same as the current run
-        // write that run out and start a new one
-
-        if (bit_cache != rle)
+        if (continuous)
         {
-            // do we have a previous run that we need to write out?
-
-            if (run != 0)
-            {
-                write_run();
-            }
-
-            // run will be zero here, set new rle value and set the
-            // new run length to one
-
-            rle = bit_cache;
+            *out_p++ = bit_cache;
+            out_len++;
+        }
+        else
+        {
+            put_byte(bit_cache);
         }
-
-        // either increments the current run length or sets it to 1
-
-        run++;
         num_bits = 0;
     }
 }
@@ -176,48 +411,266 @@ void write_bit(uint8_t bit)
 // -----------------------------------------------------------------------
 // write the lower n bits of data c out
 
-void write_bits(uint8_t c, uint8_t n)
+static void write_bits(uint32_t c, uint8_t n)
 {
-    uint8_t mask;
+    uint32_t mask;
 
-    mask = (1 << (n - 1));
+    mask = ((uint32_t)1 << (n - 1));
 
     while (mask != 0)
     {
-        write_bit(c & mask);
+        write_bit((c & mask) != 0);
         mask >>= 1;
     }
 }
 
 // -----------------------------------------------------------------------
-// write bits out zero till the bit cache is flushed then write the run
+// write a literal out as is.  in split mode it goes into the literal
+// stream instead, a whole byte or two of it, most significant first
+
+static void write_lit(uint16_t c)
+{
+    if (!split_mode)
+    {
+        write_bits(c, depth);
+        return;
+    }
+
+    if (bytes == 2)
+    {
+        *lit_p++ = c >> 8;
+    }
+    *lit_p++ = c;
+}
+
+// -----------------------------------------------------------------------
+// write bits out zero till the bit cache is flushed then write the run.
+// in continuous mode the run belongs to the winning tries, not this one
 
-void flush_bits(void)
+static void flush_bits(void)
 {
     while (num_bits != 0)
     {
         write_bit(0);
     }
-    write_run();
+
+    if (!continuous)
+    {
+        write_run();
+    }
 }
 
 // -----------------------------------------------------------------------
-// each compressed scan line has a three byte compression method tag
-// so we know how to decompress it!
+// each compressed scan line has a three (or four) bit compression method
+// tag so we know how to decompress it!
 
 static void write_tag(tag_t tag)
 {
-    write_bits(tag, 3);
+    write_bits(tag, tag_bits);
+}
+
+// -----------------------------------------------------------------------
+// start a new try of the specified method in its own try buffer
+
+static void open_try(tag_t tag)
+{
+    t_try   = sbif_now();
+    out_p   = try_buff[tag];
+    out_len = 0;
+    lit_p   = job->lit_buff[tag];
+    mark8   = mark16 = saved = 0;
+
+    write_tag(tag);
+
+    if (k >= 0)             // rice coded tries say which k they used
+    {
+        write_bits(k, 2);
+    }
+
+    memset(k_cost, 0, sizeof(k_cost));
+}
+
+// -----------------------------------------------------------------------
+// what a run of r bytes of c comes to once it is written out
+
+static int32_t run_cost(uint8_t c, uint32_t r)
+{
+    return (r == 0) ? 0
+         : ((r < 3) && (c != esc8) && (c != esc16)) ? r
+         : (r < 0x100) ? 3
+         : (r < 0x4000) ? 4
+         : (r < 0x200000) ? 5
+         : (r < 0x10000000) ? 6 : 7;
+}
+
+// -----------------------------------------------------------------------
+// continuous mode tries are left as they are till the winner is picked.
+// this is how many more bytes the n bits of one would add to the output,
+// carried on from the bits and the run the winners before it left off at
+
+static uint32_t rle_cost(uint8_t *p, uint32_t n)
+{
+    int32_t len;
+    uint32_t i;
+    uint32_t r;
+    uint8_t cache;
+    uint8_t b;
+    uint8_t c;
+
+    cache = stream_cache;
+    c     = rle;
+    r     = run;
+    len   = -run_cost(c, r);
+
+    for (i = 0; i != (n + stream_bits) / 8; i++)
+    {
+        b     = cache | (p[i] >> stream_bits);
+        cache = p[i] << (8 - stream_bits);
+
+        if ((b != c) || (r == UINT32_MAX))
+        {
+            len += run_cost(c, r);
+            c    = b;
+            r    = 0;
+        }
+        r++;
+    }
+
+    return len + run_cost(c, r);
+}
+
+// -----------------------------------------------------------------------
+// what the n bytes at p would cost if each cost what cost says it does
+
+static uint64_t score(uint8_t *p, uint32_t n, uint16_t *cost)
+{
+    uint64_t sum;
+    uint32_t i;
+
+    sum = 0;
+
+    for (i = 0; i != n; i++)
+    {
+        sum += cost[p[i]];
+    }
+
+    return sum;
+}
+
+// -----------------------------------------------------------------------
+// finish the current try and remember how well it did
+
+static void close_try(tag_t tag)
+{
+    uint8_t n;
+
+    try_bits[tag] = (out_len * 8) + num_bits;
+
+    flush_bits();
+    try_len[tag]  = continuous
+        ? rle_cost(try_buff[tag], try_bits[tag])
+        : out_len;
+    try_lits[tag] = split_mode ? lit_p - job->lit_buff[tag] : 0;
+
+    if (entropy_mode)
+    {
+        try_score[tag] = score(try_buff[tag], out_len, out_cost) +
+                         score(job->lit_buff[tag], try_lits[tag], lit_cost);
+    }
+
+    try_mark8[tag]  = mark8;
+    try_mark16[tag] = mark16;
+    try_saved[tag]  = saved;
+
+    job->stats.method[tag] += sbif_now() - t_try;
+    job->stats.tries[tag]++;
+    job->stats.cost[channel][tag] += try_len[tag] + try_lits[tag];
+
+    best_k[tag] = 0;
+
+    for (n = 1; n != 4; n++)
+    {
+        if (k_cost[n] < k_cost[best_k[tag]])
+        {
+            best_k[tag] = n;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------
+// add up what literal c would cost rice coded with each possible k
+
+static void rice_cost(uint16_t c)
+{
+    uint16_t z;
+    uint16_t q;
+    uint8_t n;
+
+    z = zigzag(c, top);
+
+    for (n = 0; n != 4; n++)
+    {
+        q = (z >> (n + k_base));
+
+        k_cost[n] += (q < RICE_LIMIT)
+            ? q + 1 + n + k_base
+            : RICE_LIMIT + depth;
+    }
+}
+
+// -----------------------------------------------------------------------
+// write literal c out as a rice code with the current k
+
+static void write_rice(uint16_t c)
+{
+    uint16_t z;
+    uint16_t q;
+
+    z = zigzag(c, top);
+    q = (z >> (k + k_base));
+
+    if (q < RICE_LIMIT)
+    {
+        while (q--)
+        {
+            write_bit(1);
+        }
+        write_bit(0);
+
+        if ((k + k_base) != 0)
+        {
+            write_bits(z, k + k_base);
+        }
+    }
+    else
+    {
+        write_bits(0xff, RICE_LIMIT);
+        write_bits(z, depth);
+    }
 }
 
 // -----------------------------------------------------------------------
-// somewhat cheezy because it assumes pixel channel data is always 8 bits
-// not sure if this is a safe assumption but this is not production code
+// a new literal, 8 or 16 bits depending on the depth of the image or just
+// enough bits for a palette index.  still called new_byte because it was
+// always a byte for the longest time
 
-static void new_byte(uint8_t c)
+static void new_byte(uint16_t c)
 {
     write_bit(1);
-    write_bits(c, 8);
+
+    if (k < 0)
+    {
+        write_lit(c);
+
+        if (rice_mode)
+        {
+            rice_cost(c);
+        }
+    }
+    else
+    {
+        write_rice(c);
+    }
 }
 
 // -----------------------------------------------------------------------
@@ -230,21 +683,19 @@ static void new_byte(uint8_t c)
 // it is a different color we output a ONE bit followed by the bits of
 // the new pixel color.
 
-void horizontal(uint8_t *p)
+static void horizontal(uint16_t *p)
 {
-    uint16_t i;
-    uint8_t c;              // previous byte
-    uint8_t d;              // current byte
+    uint32_t i;
+    uint16_t c;             // previous pixel
+    uint16_t d;             // current pixel
 
     i       = width;        // loopy thing
     in_p    = p;            // pointer to data to be compressed
-    out_p   = h_comp_buff;  // where to stage the results of this try
-    out_len = 0;
 
-    write_tag(HORIZONTAL);
+    open_try(HORIZONTAL);   // stage the results of this try
 
     c = *in_p++;            // write first pixel of scan line as is
-    write_bits(c, 8);
+    write_lit(c);
 
     // tribal knowledge incoming...
 
@@ -258,8 +709,7 @@ void horizontal(uint8_t *p)
         c = d;              // new pixel is now the previous pixel
     }
 
-    flush_bits();
-    h_comp_len = out_len;
+    close_try(HORIZONTAL);
 }
 
 // -----------------------------------------------------------------------
@@ -270,18 +720,16 @@ void horizontal(uint8_t *p)
 // written out.  Otherwise we write out a ONE bit followed by the bits of
 // the new pixel color.
 
-void vertical(uint8_t *p)
+static void vertical(uint16_t *p)
 {
-    uint16_t i;
-    uint8_t *q;
+    uint32_t i;
+    uint16_t *q;
 
     i       = width;        // loopy thing
     in_p    = p;            // point to input data current pixel
     q       = (p - width);  // point q at pixel above current one
-    out_p   = v_comp_buff;  // where to stage the results of this try
-    out_len = 0;
 
-    write_tag(VERTICAL);
+    open_try(VERTICAL);     // stage the results of this try
 
     while (i--)             // this MUST be post decrement
     {
@@ -292,89 +740,201 @@ void vertical(uint8_t *p)
         q++;
     }
 
-    flush_bits();
-    v_comp_len = out_len;
+    close_try(VERTICAL);
 }
 
 // -----------------------------------------------------------------------
-// horizontal differential compression
+// how many bits it takes to count up to y
 
-// After writing out the TAG bits, the first pixel of the scan line is
-// written out as is.  The next pixel is written out as a single ONE bit
-// followed by the difference between it and the first pixel.  For each
-// pixel after the second the delta between it and the one to it's left is
-// computed and if this delta is the same as the previous pixel's delta
-// then a single ZERO bit is written out.  Otherwise a ONE bit is written
-// followed by the new delta.
-
-void horizontal_diff(uint8_t *p)
+static uint8_t row_bits(uint32_t y)
 {
-    uint16_t i;
-    uint8_t c1;
-    uint8_t c2;
+    uint8_t n;
 
-    uint16_t d1;
-    uint16_t d2;
+    for (n = 1; (y >> n) != 0; n++)
+        ;
 
-    i       = width;        // loopy thing
-    in_p    = p;            // data to be compressed
-    out_p   = h_diff_buff;  // where to stage this try
-    out_len = 0;
+    return n;
+}
 
-    write_tag(HORIZONTAL_DIFF);
+// -----------------------------------------------------------------------
+// a scan line the same as an earlier one is nothing but its tag, a ZERO
+// bit if it is the one above or a ONE bit and how many scan lines back it
+// is in just enough bits to count up to y
 
-    c1 = *in_p++;           // first byte of scan line is first pixel
-    write_bits(c1, 8);      // as is
-    d1 = -1;                // there is no "previous" difference yet
+static void repeat(uint32_t d, uint32_t y)
+{
+    open_try(REPEAT);
+    write_bit(d != 1);
 
-    while (--i)             // MUST be pre-decrement
+    if (d != 1)
     {
-        c2 = *in_p++;       // get second++ pixel
-
-        // calculate the difference between the current pixel c2 and
-        // the previous pixel c1
-
-        d2 = (uint8_t)(c2 - c1);
-
-        (d2 == d1)
-            ? write_bit(0)
-            : new_byte(d2);
-
-        d1 = d2;
-        c1 = c2;
+        write_bits(d, row_bits(y));
     }
 
-    flush_bits();
-    h_diff_len = out_len;
+    close_try(REPEAT);
 }
 
 // -----------------------------------------------------------------------
-// vertical differential (see below)
+// shifted vertical compression
 
-// there is no need to give any function an overly verbose name.  using
-// entire sentences for function names just makes the code an unreadable
-// mess.   There is also absolutely no such thing as self documenting code
-// and people claiming there is are simply use this as a rationalization
-// for not properly commenting their code.  Un-commented code is BAD,
-// especially when you are the poor shmuck that got volunteered to take
-// over maintaining it.
+// Scrolling text or panning makes scan lines that are the one above
+// shifted left or right by a few pixels, which vertical compression sees
+// as nothing but new pixels.  Every shift from -SHIFT_MAX to SHIFT_MAX - 1
+// is counted up to see which leaves the fewest pixels different and that
+// shift is written out after the TAG bits.  Each pixel is then compared
+// to the one above it that many pixels to the left, same as vertical.
+
+// how many pixels of p are different from the ones above shifted by s.
+// the few at each end that would be compared with pixels off the end of
+// the scan line above are left out, this is only used to pick a shift
+// and leaving them out keeps the loop simple enough to vectorize
 
-static void v(uint8_t *p, uint8_t *q)
+static uint32_t misses(uint16_t *p, int s)
 {
-    uint16_t i;
-    uint8_t d1, d2;
+    uint32_t x;
+    uint32_t x0, x1;
+    uint32_t n = 0;
+    uint16_t *q;
 
-    in_p    = p;            // data to be compressed
-    i       = width;        // loopy thing
-    out_len = 0;
+    q  = (p - width) - s;
+    x0 = (s > 0) ? s : 0;
+    x1 = (s < 0) ? width + s : width;
 
-    // calculate the delta between initial two vertically adjacent pixels
+    for (x = x0; x < x1; x++)
+    {
+        n += (p[x] != q[x]);
+    }
 
-    d2 = (uint8_t)(*in_p - *q);
+    return n;
+}
+
+static void shifted(uint16_t *p)
+{
+    int s;
+    int best_s;
+    uint32_t n, least;
+    int64_t x;
+    uint16_t *q;
 
-    write_bits(d2, 8);      // write the delta
+    // too narrow to shift by the most we can and still have anything
+    // left to compare
 
-    while (--i)
+    if (width <= SHIFT_MAX)
+    {
+        return;
+    }
+
+    best_s = 0;
+    least  = width;
+
+    for (s = -SHIFT_MAX; s != SHIFT_MAX; s++)
+    {
+        n = (s != 0) ? misses(p, s) : width;
+
+        if (n < least)
+        {
+            least  = n;
+            best_s = s;
+        }
+    }
+
+    if (best_s == 0)        // vertical already tried not shifting at all
+    {
+        return;
+    }
+
+    in_p = p;
+    q    = p - width;
+
+    open_try(SHIFTED);
+    write_bits(best_s + SHIFT_MAX, SHIFT_BITS);
+
+    for (x = -best_s; x != (int64_t)width - best_s; x++)
+    {
+        (*in_p == q[(x < 0) ? 0 : (x >= width) ? width - 1 : x])
+            ? write_bit(0)
+            : new_byte(*in_p);
+        in_p++;
+    }
+
+    close_try(SHIFTED);
+}
+
+// -----------------------------------------------------------------------
+// horizontal differential compression
+
+// After writing out the TAG bits, the first pixel of the scan line is
+// written out as is.  The next pixel is written out as a single ONE bit
+// followed by the difference between it and the first pixel.  For each
+// pixel after the second the delta between it and the one to it's left is
+// computed and if this delta is the same as the previous pixel's delta
+// then a single ZERO bit is written out.  Otherwise a ONE bit is written
+// followed by the new delta.
+
+static void horizontal_diff(uint16_t *p, tag_t tag)
+{
+    uint32_t i;
+    uint16_t c1;
+    uint16_t c2;
+
+    uint32_t d1;
+    uint32_t d2;
+
+    i       = width;        // loopy thing
+    in_p    = p;            // data to be compressed
+
+    open_try(tag);          // stage this try (tag may be the rice form)
+
+    c1 = *in_p++;           // first pixel of the scan line is written
+    write_lit(c1);          // as is
+    d1 = -1;                // there is no "previous" difference yet
+
+    while (--i)             // MUST be pre-decrement
+    {
+        c2 = *in_p++;       // get second++ pixel
+
+        // calculate the difference between the current pixel c2 and
+        // the previous pixel c1
+
+        d2 = (uint16_t)(c2 - c1) & top;
+
+        (d2 == d1)
+            ? write_bit(0)
+            : new_byte(d2);
+
+        d1 = d2;
+        c1 = c2;
+    }
+
+    close_try(tag);
+}
+
+// -----------------------------------------------------------------------
+// vertical differential (see below)
+
+// there is no need to give any function an overly verbose name.  using
+// entire sentences for function names just makes the code an unreadable
+// mess.   There is also absolutely no such thing as self documenting code
+// and people claiming there is are simply use this as a rationalization
+// for not properly commenting their code.  Un-commented code is BAD,
+// especially when you are the poor shmuck that got volunteered to take
+// over maintaining it.
+
+static void v(uint16_t *p, uint16_t *q)
+{
+    uint32_t i;
+    uint16_t d1, d2;
+
+    in_p    = p;            // data to be compressed
+    i       = width;        // loopy thing
+
+    // calculate the delta between initial two vertically adjacent pixels
+
+    d2 = (uint16_t)(*in_p - *q) & top;
+
+    write_lit(d2);          // write the delta
+
+    while (--i)
     {
         d1 = d2;
         in_p++;
@@ -383,7 +943,7 @@ static void v(uint8_t *p, uint8_t *q)
         // calculate the delta between the next two vertically
         // adjacent pixels
 
-        d2 = (uint8_t)(*in_p - *q);
+        d2 = (uint16_t)(*in_p - *q) & top;
 
         // is the new delta the same as the previous difference...
 
@@ -391,8 +951,6 @@ static void v(uint8_t *p, uint8_t *q)
             ? write_bit(0)
             : new_byte(d2);
     }
-
-    flush_bits();
 }
 
 // -----------------------------------------------------------------------
@@ -405,18 +963,15 @@ static void v(uint8_t *p, uint8_t *q)
 // delta then a single ZERO bit is written out.  Otherwise a ONE bit is
 // written followed by the new delta.
 
-void vertical_diff(uint8_t *p)
+static void vertical_diff(uint16_t *p, tag_t tag)
 {
-    uint8_t *q;
-
-    q       = (p - width);  // point q at pixel above current one
-    out_p   = v_diff_buff;  // where to stage results of this try
+    uint16_t *q;
 
-    write_tag(VERTICAL_DIFF);
+    q = (p - width);        // point q at pixel above current one
 
+    open_try(tag);
     v(p, q);
-
-    v_diff_len = out_len;
+    close_try(tag);
 }
 
 // -----------------------------------------------------------------------
@@ -426,258 +981,1312 @@ void vertical_diff(uint8_t *p)
 // the deltas are computed between the current pixel and the one two scan
 // lines above it.
 
-void offset_diff(uint8_t *p)
+static void offset_diff(uint16_t *p, tag_t tag)
 {
-    uint8_t *q;
+    uint16_t *q;
 
     // point q at pixel two scan lines above the current one
 
-    q       = (p - (2 * width));
-    out_p   = z_diff_buff;  // where to stage results of this try
-
-    write_tag(OFFSET_DIFF);
+    q = (p - (2 * width));
 
+    open_try(tag);
     v(p, q);
-
-    z_diff_len = out_len;
+    close_try(tag);
 }
 
 // -----------------------------------------------------------------------
-// write the SBIF file format header out to the disk file
-
-static void write_header(void)
-{
-    sbif_header_t header;
+// predictive differential (see below)
 
-    header.magic = (uint32_t)'FIBS';
-    header.width = width;
-    header.height = height;
+// like v() but the delta for each pixel is computed against a prediction
+// made from its left, upper and upper left neighbours instead of against
+// a single pixel.  always inlined so each caller gets its own copy with
+// the predictor switch resolved at compile time
 
-    fwrite(&header, 1, sizeof(header), out_fp);
-}
+static inline void pd(uint16_t *p, tag_t tag)
+{
+    uint32_t i;
+    uint16_t *q;
+    uint16_t d1, d2;
 
-// -----------------------------------------------------------------------
-// factored out because it is just a bunch of if / and / but loops
+    in_p    = p;            // data to be compressed
+    q       = (p - width);  // point q at pixel above current one
+    i       = width;        // loopy thing
 
-static tag_t get_best(uint16_t i)
-{
-    tag_t tag;
+    // the first pixel of the scan line is predicted from the one above
 
-    if (h_comp_len < best)
-    {
-        best = h_comp_len;
-        tag = HORIZONTAL;
-    }
+    d2 = (uint16_t)(*in_p - *q) & top;
 
-    if (v_comp_len < best)
-    {
-        best = v_comp_len;
-        tag = VERTICAL;
-    }
+    write_lit(d2);
 
-    if (h_diff_len <= best)
+    while (--i)
     {
-        best = h_diff_len;
-        tag = HORIZONTAL_DIFF;
-    }
+        d1 = d2;
+        in_p++;
+        q++;
 
-    if (v_diff_len < best)
-    {
-        best = v_diff_len;
-        tag = VERTICAL_DIFF;
-    }
+        d2 = (uint16_t)(*in_p - predict(tag, in_p[-1], *q, q[-1], top));
+        d2 = d2 & top;
 
-    if (i < height - 1)
-    {
-        if (z_diff_len < best)
-        {
-            best = z_diff_len;
-            tag = OFFSET_DIFF;
-        }
+        (d2 == d1)
+            ? write_bit(0)
+            : new_byte(d2);
     }
-
-    return tag;
 }
 
 // -----------------------------------------------------------------------
-// staging area for sbif compressed scan line data which will be passed to
-// the zstd compression routines as the source buffer once all scan lines
-// of the image have been sbif compressed
+// Paeth, average and gradient differential compression (max mode)
 
-// zstd compression is stage 3
+// After writing out the TAG bits, each pixel is predicted from its left,
+// upper and upper left neighbours using the PNG Paeth predictor, the
+// average of left and up or the gradient left + up - upper left.  The
+// delta between the pixel and its prediction is then written exactly as
+// Vertical Differential Compression writes its deltas.
 
-static void s3_write(uint8_t *p, uint16_t n)
+static void paeth_diff(uint16_t *p, tag_t tag)
 {
-    memcpy(&s3_buff[s3_size], p, n);
-    s3_size += n;
+    open_try(tag);
+    pd(p, PAETH_DIFF);
+    close_try(tag);
 }
 
-// -----------------------------------------------------------------------
-// compress the entire image using stages one and two
-
-void sb_compress(uint8_t *p)
+static void average_diff(uint16_t *p, tag_t tag)
 {
-    uint16_t i;
-    uint8_t *q;
+    open_try(tag);
+    pd(p, AVERAGE_DIFF);
+    close_try(tag);
+}
 
-    tag_t tag;
+static void gradient_diff(uint16_t *p, tag_t tag)
+{
+    open_try(tag);
+    pd(p, GRADIENT_DIFF);
+    close_try(tag);
+}
 
-    i = height;
+// -----------------------------------------------------------------------
+// cross channel differential compression (cross mode)
+
+// Edges in one color channel are almost always edges in the others too.
+// After writing out the TAG bits the delta between the first pixel and
+// the same pixel of the channel compressed before this one is written
+// out as is.  For each pixel after that the delta between it and the
+// same pixel of the channel before is computed and if it is the same as
+// the previous delta a single ZERO bit is written out, which is when both
+// channels went up or down by the same amount.  Otherwise a ONE bit is
+// written followed by how much the delta changed, which is small when
+// they went the same way by different amounts.
+
+static void cross_diff(uint16_t *p, tag_t tag)
+{
+    uint32_t i;
+    uint16_t *q;
+    uint16_t d1, d2;
 
-    reset();
+    in_p = p;
+    q    = ref + (p - job->p);  // same pixel of the channel before
+    i    = width;
 
-    horizontal(p);          // first scan always compressed horizontally
-    printf("▬");            // graph each scan lines compression method
+    open_try(tag);
 
-    // write the compressed data of the first scan line out to zstd
-    // staging buffer
+    d2 = (uint16_t)(*in_p - *q) & top;
 
-    s3_write(h_comp_buff, h_comp_len);
+    write_lit(d2);
 
     while (--i)
     {
-        p += width;         // point p at next scan line
+        d1 = d2;
+        in_p++;
+        q++;
 
-        best = -1;
+        d2 = (uint16_t)(*in_p - *q) & top;
 
-        horizontal(p);      // try each method
-        vertical(p);
-        horizontal_diff(p);
-        vertical_diff(p);
+        (d2 == d1)
+            ? write_bit(0)
+            : new_byte((uint16_t)(d2 - d1) & top);
+    }
+
+    close_try(tag);
+}
 
-        if (i < height - 1)
+// -----------------------------------------------------------------------
+// rice coded differential compression (rice mode)
+
+// Each differential method that was tried on this scan line is tried
+// again with its literals rice coded using the k that would have been
+// cheapest for the literals of its first try.
+
+static void try_rice(uint16_t *p)
+{
+    tag_t tag;
+
+    for (tag = HORIZONTAL_DIFF; tag <= GRADIENT_DIFF; tag++)
+    {
+        if (try_len[tag] == (uint32_t)-1)
         {
-            offset_diff(p);
+            continue;       // method was not tried on this scan line
         }
 
-        tag = get_best(i);
-
-        // point q to the try buffer with the best results and
-        // visually graph the selected decompression method
+        k = best_k[tag];
 
         switch (tag)
         {
-            case HORIZONTAL:      q = h_comp_buff;   printf("▬");  break;
-            case VERTICAL:        q = v_comp_buff;   printf("▮");  break;
-            case HORIZONTAL_DIFF: q = h_diff_buff;   printf("▭");  break;
-            case VERTICAL_DIFF:   q = v_diff_buff;   printf("▯");  break;
-            case OFFSET_DIFF:     q = z_diff_buff;   printf("◈");  break;
+            case HORIZONTAL_DIFF: horizontal_diff(p, tag + RICE);  break;
+            case VERTICAL_DIFF:   vertical_diff(p,   tag + RICE);  break;
+            case OFFSET_DIFF:     offset_diff(p,     tag + RICE);  break;
+            case PAETH_DIFF:      paeth_diff(p,      tag + RICE);  break;
+            case AVERAGE_DIFF:    average_diff(p,    tag + RICE);  break;
+            case GRADIENT_DIFF:   gradient_diff(p,   tag + RICE);  break;
+            default:                                               break;
         }
+    }
 
-        s3_write(q, best);
+    if (try_len[CROSS_DIFF] != (uint32_t)-1)
+    {
+        k = best_k[CROSS_DIFF];
+        cross_diff(p, X_DIFF_RICE);
     }
 
-    printf("\n\n");
+    k = -1;
 }
 
 // -----------------------------------------------------------------------
+// write the SBIF file format header out to the disk file
 
-static void load_png(void)
+static void write_header(void)
 {
-    unsigned error;
+    sbif_header_t header;
+
+    header.magic = (uint32_t)'FIBS';
+    header.width = image_w;
+    header.height = image_h;
+    header.version = SBIF_VERSION;
+    header.tag_bits = tag_bits;
+    header.channels = channels;
+    header.color = color;
+    header.tile_w = tile_w;
+    header.tile_h = tile_h;
+    header.depth = bytes * 8;
+    header.flags = (split_mode ? FLAG_SPLIT : 0) |
+                   (continuous ? FLAG_CONTINUOUS : 0);
+    header.colors = colors;
+    header.mark8 = esc8;
+    header.mark16 = esc16;
+    header.reserved = 0;
+
+    fwrite(&header, 1, sizeof(header), out_fp);
+}
+
+// -----------------------------------------------------------------------
+// the palette goes right after the header, each color being the channels
+// of the image in the same order they would be compressed in
 
-    error = lodepng_decode32_file(&png_image, &width, &height, infile);
+static void write_palette(void)
+{
+    int i;
+    int c;
+    uint8_t *p;
 
-    if(error)
+    for (i = 0; i != colors; i++)
     {
-        printf("error %u: %s\n", error, lodepng_error_text(error));
-        exit(0);
+        p = &palette[i * format_bpp[palette_format]];
+
+        for (c = 0; c != channels; c++)
+        {
+            fputc(p[layouts[palette_format][c]], out_fp);
+        }
     }
+}
+
+// -----------------------------------------------------------------------
+// what a try cost, literals and all, or what it is estimated to cost once
+// zstd is done with it in entropy mode
 
-    size   = width * height;
+static uint64_t try_cost(tag_t t)
+{
+    return entropy_mode
+        ? try_score[t]
+        : (uint64_t)try_len[t] + try_lits[t];
 }
 
 // -----------------------------------------------------------------------
+// pick whichever try costs the least.  ties go to the lowest tag.  the
+// tries that were not made have a length (and score) of -1, which is
+// still more than anything once it is added up in 64 bits
 
-static void zstd_compress(void)
+static tag_t get_best(void)
 {
-    void *z_out_buff;
+    tag_t tag;
+    tag_t t;
 
-    size_t z_size = ZSTD_compressBound(s3_size);
+    tag  = HORIZONTAL;
+    best = try_cost(HORIZONTAL);
 
-    z_out_buff = calloc(z_size, 1);
+    for (t = VERTICAL; t != NUM_TAGS; t++)
+    {
+        if (try_cost(t) < best)
+        {
+            best = try_cost(t);
+            tag  = t;
+        }
+    }
 
-    z_size = ZSTD_compress(z_out_buff, z_size, s3_buff, s3_size, 9);
+    return tag;
+}
 
-    write_header();         // write SBIF image header to file
+// -----------------------------------------------------------------------
+// remember the method of each scan line so it can be graphed afterwards
+// (sbif -v, dsbif -v).  GRAPH_END goes after the last scan line of each
+// channel
 
-    fwrite(z_out_buff, 1, z_size, out_fp);
-    fclose(out_fp);
+static void graph(uint8_t tag)
+{
+    job->tags[job->num_tags++] = tag;
 }
 
 // -----------------------------------------------------------------------
+// continuous mode.  the n bits of the winning try at src carry on from
+// wherever the bits of the one before left off and are run length
+// encoded a byte at a time as they fill up.  at the end of a segment the
+// last few bits are flushed out with ZERO bits after them
 
-void main(int argc, char **argv)
+static void s3_stream(uint8_t *src, uint32_t n, int end)
 {
     uint32_t i;
-    FILE *raw_fp;
+    uint8_t c;
+
+    out_p   = &job->out[job->out_size];
+    out_len = 0;
+    mark8   = mark16 = saved = 0;
 
-    infile  = argv[1];
-    outfile = argv[2];
+    for (i = 0; i != n / 8; i++)
+    {
+        put_byte(stream_cache | (src[i] >> stream_bits));
+        stream_cache = src[i] << (8 - stream_bits);
+    }
 
-    load_png();
+    n %= 8;
 
-    out_fp = fopen(outfile, "wb");
-    printf("%s %d %d\n\n", infile, width, height);
+    if (n != 0)             // the try was padded out with ZERO bits
+    {
+        c = src[i] & (0xff << (8 - n));
+        stream_cache |= c >> stream_bits;
 
-    // try buffers for each compression method
+        if (stream_bits + n >= 8)
+        {
+            put_byte(stream_cache);
+            stream_cache = c << (8 - stream_bits);
+        }
+        stream_bits = (stream_bits + n) % 8;
+    }
 
-    h_comp_buff  = calloc(width * 4, 1);
-    v_comp_buff  = calloc(width * 4, 1);
-    h_diff_buff  = calloc(width * 4, 1);
-    v_diff_buff  = calloc(width * 4, 1);
-    z_diff_buff  = calloc(width * 4, 1);
+    if (end)
+    {
+        if (stream_bits != 0)
+        {
+            put_byte(stream_cache);
+        }
 
-    // each color channel gets loaded into its own buffer
+        if (run != 0)
+        {
+            write_run();
+        }
 
-    r_buff = calloc(size, 1);
-    g_buff = calloc(size, 1);
-    b_buff = calloc(size, 1);
-    a_buff = calloc(size, 1);
+        stream_cache = 0;
+        stream_bits  = 0;
+    }
 
-    in_p = png_image;
+    job->out_size        += out_len;
+    job->stats.mark8     += mark8;
+    job->stats.mark16    += mark16;
+    job->stats.rle_saved += saved;
+}
 
-    s3_buff = calloc(size * 6, 1);
+// -----------------------------------------------------------------------
+// staging area for sbif compressed scan line data which will be passed to
+// the zstd compression routines as the source buffer once all scan lines
+// of the image have been sbif compressed
 
-    // having to do this part is annoying
+// zstd compression is stage 3.  this is also where the winning try of
+// each scan line gets counted
 
-    for (i = 0; i < size; i++)
+static void s3_write(tag_t tag)
+{
+    if (continuous)
     {
-        r_buff[i] = *in_p++;
-        g_buff[i] = *in_p++;
-        b_buff[i] = *in_p++;
-        a_buff[i] = *in_p++;
+        s3_stream(try_buff[tag], try_bits[tag], 0);
     }
+    else
+    {
+        memcpy(&job->out[job->out_size], try_buff[tag], try_len[tag]);
+        job->out_size += try_len[tag];
 
-    free(png_image);
+        job->stats.mark8     += try_mark8[tag];
+        job->stats.mark16    += try_mark16[tag];
+        job->stats.rle_saved += try_saved[tag];
+    }
 
-    // save out the uncompressed data so we can verify our
-    // decompression results
+    memcpy(&job->lits[job->lits_size], job->lit_buff[tag], try_lits[tag]);
+    job->lits_size += try_lits[tag];
 
-    raw_fp = fopen("image.raw", "wb");
-    fwrite(r_buff, 1, size, raw_fp);
-    fwrite(g_buff, 1, size, raw_fp);
-    fwrite(b_buff, 1, size, raw_fp);
-    fwrite(a_buff, 1, size, raw_fp);
-    fclose(raw_fp);
+    job->stats.wins[channel][tag]++;
+    graph(tag);
+}
 
-    // compress each channel independently
+// -----------------------------------------------------------------------
+// compress the scan lines of one job.  every scan line is flushed out to
+// a byte boundary and every method only ever looks at pixels, never at
+// what was written before it, so any range of scan lines can be
+// compressed without knowing anything about the ones before it.  in
+// continuous mode that goes for every SEGMENT_ROWS scan lines instead
 
-    start = clock();
+static void *sb_rows(void *arg)
+{
+    uint32_t y;
+    uint32_t d;
+    uint16_t *p;
 
-    sb_compress(r_buff);
-    sb_compress(g_buff);
-    sb_compress(b_buff);
-    sb_compress(a_buff);
+    tag_t tag;
 
-    zstd_compress();
+    job = arg;
+    memcpy(try_buff, job->try_buff, sizeof(try_buff));
 
-    finish = clock();
+    reset();
 
-    printf("%dms\n\n", (int)(finish - start) / 1000);
+    for (y = job->y0; y != job->y1; y++)
+    {
+        p = job->p + ((size_t)y * width);
 
-    // misra violation!  Guru Meditation, too lazy to free buffers
-}
+        if (continuous && (y != job->y0) && ((y % SEGMENT_ROWS) == 0))
+        {
+            s3_stream(NULL, 0, 1);
+        }
 
-// =======================================================================
+        if (y == 0)
+        {
+            horizontal(p);  // first scan always compressed horizontally
+            s3_write(HORIZONTAL);
+            continue;
+        }
+
+        // a scan line the same as the one above can't do better than a
+        // repeat, or a vertical try that is all ZERO bits when the tags
+        // are only three bits, so nothing else gets tried.  neither can
+        // one the same as any earlier scan line as long as the count of
+        // how far back it is takes fewer bits than there are pixels
+
+        d = !repeats ? 0
+          : (copies && (same[y] == y)) ? 0
+          : (memcmp(p, p - width, width * sizeof(uint16_t)) == 0) ? 1
+          : (copies && (row_bits(y) < width)) ? y - same[y] : 0;
+
+        if (d != 0)
+        {
+            repeat(d, y);
+            s3_write(REPEAT);
+            continue;
+        }
+
+        if (!repeats &&
+            (memcmp(p, p - width, width * sizeof(uint16_t)) == 0))
+        {
+            vertical(p);
+            s3_write(VERTICAL);
+            continue;
+        }
+
+        memset(try_len, 0xff, sizeof(try_len));
+        memset(try_score, 0xff, sizeof(try_score));
+
+        horizontal(p);      // try each method
+        vertical(p);
+        horizontal_diff(p, HORIZONTAL_DIFF);
+        vertical_diff(p, VERTICAL_DIFF);
+
+        if (y > 1)
+        {
+            offset_diff(p, OFFSET_DIFF);
+        }
+
+        if (max_mode)
+        {
+            paeth_diff(p, PAETH_DIFF);
+            average_diff(p, AVERAGE_DIFF);
+            gradient_diff(p, GRADIENT_DIFF);
+        }
+
+        if (cross_mode && (ref != NULL))
+        {
+            cross_diff(p, CROSS_DIFF);
+        }
+
+        if (rice_mode)
+        {
+            try_rice(p);
+        }
+
+        if (shift_mode)
+        {
+            shifted(p);
+        }
+
+        tag = get_best();
 
+        // write out the try buffer with the best results
+
+        s3_write(tag);
+    }
+
+    if (continuous && (job->y0 != job->y1))
+    {
+        s3_stream(NULL, 0, 1);
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------
+// add up what a job counted
+
+static void add_stats(sbif_stats_t *s)
+{
+    tag_t t;
+
+    for (t = HORIZONTAL; t != NUM_TAGS; t++)
+    {
+        stats->method[t] += s->method[t];
+        stats->tries[t]  += s->tries[t];
+
+        stats->wins[channel][t] += s->wins[channel][t];
+        stats->cost[channel][t] += s->cost[channel][t];
+    }
+
+    stats->mark8     += s->mark8;
+    stats->mark16    += s->mark16;
+    stats->rle_saved += s->rle_saved;
+}
+
+// -----------------------------------------------------------------------
+// find the earliest scan line of the channel each one is the same as.
+// only the first of each different scan line goes into the hash table so
+// that is the one any later copies of it find
+
+static void find_same(uint16_t *p)
+{
+    uint64_t h;
+    uint32_t x, y;
+    uint32_t r;
+    uint16_t *q;
+
+    memset(row_hash, 0, hash_size * sizeof(uint32_t));
+
+    for (y = 0; y != height; y++)
+    {
+        q = p + ((size_t)y * width);
+        h = 0xcbf29ce484222325;     // FNV-1a, a pixel at a time
+
+        for (x = 0; x != width; x++)
+        {
+            h = (h ^ q[x]) * 0x100000001b3;
+        }
+
+        h = (h ^ (h >> 32)) & (hash_size - 1);
+        same[y] = y;
+
+        while ((r = row_hash[h]) != 0)
+        {
+            if (memcmp(q, p + ((size_t)(r - 1) * width),
+                       width * sizeof(uint16_t)) == 0)
+            {
+                same[y] = r - 1;
+                break;
+            }
+            h = (h + 1) & (hash_size - 1);
+        }
+
+        if (same[y] == y)
+        {
+            row_hash[h] = y + 1;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------
+// read the run at p back in, returns where the next one starts
+
+static uint8_t *read_run(uint8_t *p, uint8_t *c, uint32_t *r)
+{
+    *c = *p++;
+    *r = 1;
+
+    if (*c == MARK8)
+    {
+        *r = *p++;
+        *c = *p++;
+    }
+    else if (*c == MARK16)
+    {
+        for (*r = 0; (*p & 0x80) != 0; p++)
+        {
+            *r = (*r << 7) | (*p & 0x7f);
+        }
+
+        *r = (*r << 7) | *p++;
+        *c = *p++;
+    }
+
+    return p;
+}
+
+// -----------------------------------------------------------------------
+// the cheapest byte that is not skip.  the default marker is kept unless
+// that saves at least a quarter of what it costs, a few bytes here and
+// there are not worth making zstd see a different marker for
+
+static uint8_t cheapest(uint32_t *cost, int skip, uint8_t mark)
+{
+    int c;
+    int i;
+
+    c = (skip != 0) ? 0 : 1;
+
+    for (i = c + 1; i != 256; i++)
+    {
+        c = ((i != skip) && (cost[i] < cost[c])) ? i : c;
+    }
+
+    return ((mark != skip) &&
+            ((uint64_t)cost[c] * 4 >= (uint64_t)cost[mark] * 3))
+        ? mark : c;
+}
+
+// -----------------------------------------------------------------------
+// pick the two bytes that cost the least as this images run markers.
+// every run of one under three long has to be escaped so a byte costs
+// whatever that comes to.  the first tile is always written with MARK8
+// and MARK16, this adds up what every byte would cost from the runs of
+// all of its channels and then writes them back out with the cheapest
+// two.  every tile after it uses them from the start
+
+static void pick_markers(void)
+{
+    uint32_t cost[256];
+    uint32_t flags;
+    uint8_t *p;
+    uint8_t *q;
+    uint8_t c;
+    uint32_t r;
+    int i;
+
+    memset(cost, 0, sizeof(cost));
+
+    for (i = 0; i != planes; i++)
+    {
+        for (p = &s3_buff[rle_at[i]]; p != &s3_buff[rle_end[i]]; )
+        {
+            p = read_run(p, &c, &r);
+            cost[c] += (r < 3) ? 3 - r : 0;
+        }
+    }
+
+    esc8  = cheapest(cost, -1, MARK8);
+    esc16 = cheapest(cost, esc8, MARK16);
+
+    // run for run into the zstd output buffer which is not in use yet.
+    // split mode literals come along as they are
+
+    q     = z_out_buff;
+    mark8 = mark16 = saved = 0;
+
+    for (i = 0; i != planes; i++)
+    {
+        out_p   = q + (split_mode ? 4 : 0);
+        out_len = 0;
+
+        for (p = &s3_buff[rle_at[i]]; p != &s3_buff[rle_end[i]]; )
+        {
+            p = read_run(p, &rle, &run);
+            write_run();
+        }
+
+        if (split_mode)
+        {
+            flags = out_len;
+            memcpy(q, &flags, 4);
+        }
+
+        memcpy(out_p, p, lits_end[i] - rle_end[i]);
+        q = out_p + (lits_end[i] - rle_end[i]);
+    }
+
+    s3_size = q - z_out_buff;
+    memcpy(s3_buff, z_out_buff, s3_size);
+
+    stats->mark8     = mark8;   // nothing else has been counted yet
+    stats->mark16    = mark16;
+    stats->rle_saved = saved;
+}
+
+// -----------------------------------------------------------------------
+// log base 2 of n in 1/256ths, n is at least 1.  n is scaled to between 1
+// and 2 and each bit of the fraction is had by squaring it
+
+static uint32_t log_2(uint64_t n)
+{
+    uint32_t l;
+    uint64_t x;
+    int i;
+
+    for (l = 0; (n >> l) > 1; l++)
+        ;
+
+    x = (l > 31) ? n >> (l - 31) : n << (31 - l);
+    l = l << 8;
+
+    for (i = 7; i >= 0; i--)
+    {
+        x = (x * x) >> 31;
+
+        if (x >= ((uint64_t)2 << 31))
+        {
+            x >>= 1;
+            l  += 1 << i;
+        }
+    }
+
+    return l;
+}
+
+// -----------------------------------------------------------------------
+// count the n bytes at p and work out what each byte value costs now.
+// every value is counted as having been seen once more than it has
+
+static void learn(uint8_t *p, size_t n, uint64_t *hist, uint16_t *cost)
+{
+    uint64_t total;
+    size_t i;
+
+    for (i = 0; i != n; i++)
+    {
+        hist[p[i]]++;
+    }
+
+    for (total = 256, i = 0; i != 256; i++)
+    {
+        total += hist[i];
+    }
+
+    for (i = 0; i != 256; i++)
+    {
+        cost[i] = log_2(total) - log_2(hist[i] + 1);
+    }
+}
+
+// -----------------------------------------------------------------------
+// compress the entire channel using stages one and two, split up between
+// as many threads as it is worth
+
+static void sb_compress(uint16_t *p)
+{
+    pthread_t tid[MAX_THREADS];
+    job_t *j;
+    uint32_t flags;
+    uint32_t unit;
+    uint32_t units;
+    size_t start;
+    int n;
+    int i;
+
+    stats->rows += height;
+
+    if (copies)
+    {
+        find_same(p);
+    }
+
+    n = ((size_t)width * height >= (size_t)THREAD_PIXELS * threads)
+        ? threads : 1;
+
+    // jobs only ever start at the start of a segment in continuous mode,
+    // the file has to come out the same however many threads there are
+
+    unit  = continuous ? SEGMENT_ROWS : 1;
+    units = (height + unit - 1) / unit;
+
+    // in split mode the channel starts with how long its flag bits are,
+    // the literals come after them
+
+    start    = s3_size;
+    s3_size += split_mode ? 4 : 0;
+
+    // the first job writes straight into the staging buffer, the rest
+    // are copied in after it
+
+    jobs[0].out  = &s3_buff[s3_size];
+    jobs[0].tags = &tag_buff[num_tags];
+
+    for (i = 0; i != n; i++)
+    {
+        j = &jobs[i];
+
+        j->p  = p;
+        j->y0 = (((uint64_t)units * i) / n) * unit;
+        j->y1 = (((uint64_t)units * (i + 1)) / n) * unit;
+        j->y1 = (j->y1 > height) ? height : j->y1;
+
+        j->out_size  = 0;
+        j->num_tags  = 0;
+        j->lits_size = 0;
+        memset(&j->stats, 0, sizeof(j->stats));
+
+        if (i != 0)
+        {
+            pthread_create(&tid[i], NULL, sb_rows, j);
+        }
+    }
+
+    sb_rows(&jobs[0]);
+
+    for (i = 0; i != n; i++)
+    {
+        j = &jobs[i];
+
+        if (i != 0)
+        {
+            pthread_join(tid[i], NULL);
+
+            memcpy(&s3_buff[s3_size], j->out, j->out_size);
+            memcpy(&tag_buff[num_tags], j->tags, j->num_tags);
+        }
+
+        s3_size  += j->out_size;
+        num_tags += j->num_tags;
+
+        add_stats(&j->stats);
+    }
+
+    rle_at[channel]  = start + (split_mode ? 4 : 0);
+    rle_end[channel] = s3_size;
+
+    if (split_mode)
+    {
+        flags = s3_size - start - 4;
+        memcpy(&s3_buff[start], &flags, 4);
+
+        for (i = 0; i != n; i++)
+        {
+            memcpy(&s3_buff[s3_size], jobs[i].lits, jobs[i].lits_size);
+            s3_size += jobs[i].lits_size;
+        }
+    }
+
+    lits_end[channel] = s3_size;
+
+    if (entropy_mode)
+    {
+        learn(&s3_buff[rle_at[channel]], rle_end[channel] - rle_at[channel],
+              out_hist, out_cost);
+        learn(&s3_buff[rle_end[channel]], s3_size - rle_end[channel],
+              lit_hist, lit_cost);
+    }
+
+    tag_buff[num_tags++] = GRAPH_END;
+}
+
+// -----------------------------------------------------------------------
+// zstd compress everything in the staging buffer into its own frame
+
+static void zstd_compress(void)
+{
+    size_t z_size;
+    double t0, t1;
+
+    t0     = sbif_now();
+    z_size = ZSTD_compress(z_out_buff, z_out_size, s3_buff, s3_size, 9);
+    t1     = sbif_now();
+
+    fwrite(z_out_buff, 1, z_size, out_fp);
+
+    stats->stage3 += t1 - t0;
+    stats->write  += sbif_now() - t1;
+
+    stats->stage12_bytes += s3_size;
+    stats->stage3_bytes  += z_size;
+
+    // remember the size of this frame for the seek table
+
+    seek_table[(num_frames * 2)]     = z_size;
+    seek_table[(num_frames * 2) + 1] = s3_size;
+
+    num_frames++;
+    s3_size = 0;
+}
+
+// -----------------------------------------------------------------------
+// a tiled image ends with a seek table giving the size of each tiles
+// frame.  this uses the zstd seekable format so that the file minus its
+// header is a valid seekable zstd stream
+
+static void write_seek_table(void)
+{
+    uint32_t footer[3];
+
+    footer[0] = SEEK_SKIPPABLE;
+    footer[1] = (num_frames * 8) + SEEK_FOOTER;
+
+    fwrite(footer, 1, 8, out_fp);
+    fwrite(seek_table, 8, num_frames, out_fp);
+
+    // number of frames, a zero descriptor byte and the seekable magic
+
+    fwrite(&num_frames, 1, 4, out_fp);
+    fputc(0, out_fp);
+
+    footer[2] = SEEK_MAGIC;
+    fwrite(&footer[2], 1, 4, out_fp);
+}
+
+// -----------------------------------------------------------------------
+// get channel c of the tile at x, y into a buffer of its own
+
+static uint16_t *get_tile(int c, uint32_t x, uint32_t y)
+{
+    uint32_t i;
+    uint32_t j;
+    uint8_t *src;
+    uint16_t *p;
+
+    src  = pixels + ((size_t)y * stride) + ((size_t)x * bpp);
+    src += (plane * c) + (layout[c] * bytes);
+    p    = t_buff + ((c & 1) * tile_w * tile_h);
+    ref  = (c != 0) ? t_buff + ((~c & 1) * tile_w * tile_h) : NULL;
+
+    // having to do this part is annoying
+
+    for (i = 0; i != height; i++)
+    {
+        for (j = 0; j != width; j++)
+        {
+            *p++ = (bytes == 1)
+                ? src[j * bpp]
+                : *(uint16_t *)&src[j * bpp];
+        }
+        src += stride;
+    }
+
+    return t_buff + ((c & 1) * tile_w * tile_h);
+}
+
+// -----------------------------------------------------------------------
+// compress each channel of the tile at x, y into its own zstd frame
+
+static void compress_tile(uint32_t x, uint32_t y)
+{
+    int c;
+    double t0, t1;
+    uint16_t *p;
+
+    width  = image_w - x;   // tiles on the right and bottom edges of
+    height = image_h - y;   // the image can be smaller than the rest
+
+    width  = (width  < tile_w) ? width  : tile_w;
+    height = (height < tile_h) ? height : tile_h;
+
+    for (c = 0; c != planes; c++)
+    {
+        channel = c;
+
+        t0 = sbif_now();
+        p  = get_tile(c, x, y);
+        t1 = sbif_now();
+
+        sb_compress(p);
+
+        stats->split   += t1 - t0;
+        stats->stage12 += sbif_now() - t1;
+    }
+
+    // the header waits for the first tile to pick the run markers
+
+    if (num_frames == 0)
+    {
+        t0 = sbif_now();
+        pick_markers();
+        t1 = sbif_now();
+
+        stats->stage12 += t1 - t0;
+
+        write_header();     // write SBIF image header to file
+        write_palette();
+        stats->write += sbif_now() - t1;
+    }
+
+    zstd_compress();
+}
+
+// -----------------------------------------------------------------------
+// worst case size of a scan line of n bits once it is run length encoded.
+// no run ever comes out more than three times as long as it went in and
+// that is only for a lone MARK8 or MARK16 byte which has to be escaped
+
+static size_t rle_bound(size_t bits)
+{
+    return ((bits + 7) / 8) * 3;
+}
+
+// -----------------------------------------------------------------------
+// the most one try can come to.  every method writes its literals with a
+// ONE bit in front of them and rice coded literals (after the 2 bit k)
+// can be up to depth + 6 bits long.  the plain ones leave room for the
+// shift of a shifted try
+
+static size_t try_bound(tag_t tag)
+{
+    return (tag < RICE)
+        ? rle_bound(tag_bits + SHIFT_BITS + (tile_w * (depth + 1)))
+        : rle_bound(tag_bits + 2 + (tile_w * (depth + 7)));
+}
+
+// -----------------------------------------------------------------------
+// the most the literals of this many scan lines can come to in split mode,
+// they are never more than one per pixel
+
+static size_t lits_bound(size_t rows)
+{
+    return split_mode ? rows * tile_w * bytes : 0;
+}
+
+// -----------------------------------------------------------------------
+// the most stage two can produce for one full tile.  every pixel after
+// the first costs at most depth + 1 bits in a horizontal try, and as that
+// try is always made no scan line can ever be bigger than it could be.
+// except in entropy mode, where a longer try can win on its score so a
+// scan line can be as big as the biggest try
+
+static size_t row_bound(void)
+{
+    if (entropy_mode)
+    {
+        return try_bound(rice_mode ? H_DIFF_RICE : HORIZONTAL);
+    }
+
+    return rle_bound(tag_bits + depth + ((tile_w - 1) * (depth + 1)));
+}
+
+static size_t s3_bound(void)
+{
+    return (tile_h * 4 * row_bound()) + (4 * (lits_bound(tile_h) + 4));
+}
+
+// -----------------------------------------------------------------------
+// get every working buffer out of the arena
+
+static void get_buffers(void)
+{
+    size_t tile_size;
+    size_t across;
+    size_t tiles;
+    size_t rows;
+    uint32_t i;
+    int j;
+
+    tile_size = tile_w * tile_h;
+
+    across = (image_w + tile_w - 1) / tile_w;
+    tiles  = across * ((image_h + tile_h - 1) / tile_h);
+
+    // try buffers for each compression method that can be tried, for
+    // each thread
+
+    for (j = 0; j != threads; j++)
+    {
+        for (i = 0; i != NUM_TAGS; i++)
+        {
+            jobs[j].try_buff[i] = tried[i] ? carve(try_bound(i)) : NULL;
+            jobs[j].lit_buff[i] = tried[i] ? carve(lits_bound(1)) : NULL;
+        }
+    }
+
+    // every thread but the first needs somewhere to put its share of the
+    // scan lines of a channel until they can be joined up
+
+    rows = (tile_h + threads - 1) / threads;
+    rows = continuous
+        ? ((rows + SEGMENT_ROWS - 1) / SEGMENT_ROWS) * SEGMENT_ROWS
+        : rows;
+
+    for (j = 1; j != threads; j++)
+    {
+        jobs[j].out  = carve(rows * row_bound());
+        jobs[j].tags = carve(rows);
+        jobs[j].lits = carve(lits_bound(rows));
+    }
+
+    // and in split mode they all do for their literals.  the first one
+    // gets all the scan lines when a channel is not worth splitting up
+
+    jobs[0].lits = carve(lits_bound(tile_h));
+
+    for (hash_size = 1; hash_size < (size_t)tile_h * 2; hash_size <<= 1)
+        ;
+
+    same       = carve(tile_h * sizeof(uint32_t));
+    row_hash   = carve(hash_size * sizeof(uint32_t));
+    s3_buff    = carve(s3_bound());
+    t_buff     = carve(tile_size * 2 * sizeof(uint16_t));
+    z_out_size = ZSTD_compressBound(s3_bound());
+    z_out_buff = carve(z_out_size);
+    seek_table = carve(tiles * 8);
+    s3_size    = 0;
+
+    // a tag for every scan line of every channel of every tile, plus the
+    // GRAPH_END after each channel
+
+    tag_buff = carve(((image_h * across) + tiles) * 4);
+}
+
+// -----------------------------------------------------------------------
+
+void sbif_encode_free(void)
+{
+    free(arena);
+
+    arena      = NULL;
+    arena_size = 0;
+}
+
+// -----------------------------------------------------------------------
+// set up the image dimensions, options and tile size
+
+static void set_image(uint32_t w, uint32_t h, sbif_options_t *options)
+{
+    tag_t t;
+
+    image_w   = w;
+    image_h   = h;
+    size      = (size_t)w * h;
+
+    max_mode  = options->max_mode;
+    rice_mode = options->rice_mode;
+    threads   = options->threads;
+    tile_w    = options->tile_w;
+    tile_h    = options->tile_h;
+
+    shift_mode = options->shift_mode;
+    cross_mode = options->cross_mode;
+    split_mode = options->split_mode;
+    continuous = options->continuous;
+
+    esc8  = MARK8;
+    esc16 = MARK16;
+
+    // the bytes of a continuous try are not the bytes that get written
+    // out, those depend on where the one before it left off
+
+    entropy_mode = options->entropy_mode && !continuous;
+
+    memset(out_hist, 0, sizeof(out_hist));
+    memset(lit_hist, 0, sizeof(lit_hist));
+    learn(NULL, 0, out_hist, out_cost);
+    learn(NULL, 0, lit_hist, lit_cost);
+
+    copies     = rice_mode || shift_mode || cross_mode || options->copy_mode;
+    repeats    = copies || options->repeat_mode;
+    tag_bits   = cross_mode ? 5 : repeats ? 4 : 3;
+
+    // the five methods that are always tried, the ones each mode adds and
+    // the rice coded forms of whichever differential ones are tried
+
+    memset(tried, 0, sizeof(tried));
+
+    for (t = HORIZONTAL; t <= GRADIENT_DIFF; t++)
+    {
+        tried[t] = (t <= OFFSET_DIFF) || max_mode;
+    }
+
+    tried[REPEAT]     = repeats;
+    tried[SHIFTED]    = shift_mode;
+    tried[CROSS_DIFF] = cross_mode;
+
+    for (t = HORIZONTAL_DIFF; t <= GRADIENT_DIFF; t++)
+    {
+        tried[t + RICE] = rice_mode && tried[t];
+    }
+
+    tried[X_DIFF_RICE] = rice_mode && cross_mode;
+
+    threads   = (threads < 1) ? 1
+              : (threads > MAX_THREADS) ? MAX_THREADS : threads;
+
+    bytes     = (options->depth == 16) ? 2 : 1;
+    depth     = bytes * 8;
+    colors    = options->colors;
+
+    // palette indices only need enough bits to count the colors
+
+    if (colors != 0)
+    {
+        bytes = 1;
+
+        for (depth = 1; (1 << depth) < colors; depth++)
+            ;
+    }
+
+    top       = (1 << depth) - 1;
+    k_base    = (depth > 8) ? depth - 8 : 0;
+
+    // big images are banded unless tiles or bands were asked for.  -b 0
+    // will force a single frame
+
+    if ((tile_w == 0) && (tile_h == 0) && (size > BAND_PIXELS))
+    {
+        tile_w = image_w;
+        tile_h = (BAND_PIXELS / image_w) + 1;
+    }
+
+    // no tiles is the same thing as one tile the size of the image
+
+    tile_w = ((tile_w <= 0) || (tile_w > image_w)) ? image_w : tile_w;
+    tile_h = ((tile_h <= 0) || (tile_h > image_h)) ? image_h : tile_h;
+
+    // an empty image has no tiles at all but still needs a tile size to
+    // work out that it has none
+
+    tile_w = (tile_w != 0) ? tile_w : 1;
+    tile_h = (tile_h != 0) ? tile_h : 1;
+}
+
+// -----------------------------------------------------------------------
+// the most that compressing a w x h image with these options can ever
+// write out, so callers can have an output buffer ready for it
+
+size_t sbif_compress_bound(uint32_t w, uint32_t h, sbif_options_t *options)
+{
+    size_t tiles;
+
+    set_image(w, h, options);
+
+    tiles = ((image_w + tile_w - 1) / tile_w) *
+            ((image_h + tile_h - 1) / tile_h);
+
+    return sizeof(sbif_header_t) + (tiles * ZSTD_compressBound(s3_bound()))
+         + ((tiles != 1) ? (tiles * 8) + 8 + SEEK_FOOTER : 0)
+         + (colors * 4);
+}
+
+// -----------------------------------------------------------------------
+// compress width x height RGBA pixels out to fp
+
+int sbif_encode(FILE *fp, uint8_t *rgba, uint32_t w, uint32_t h,
+    sbif_options_t *options, sbif_stats_t *s)
+{
+    return sbif_encode_pixels(fp, rgba, w, h,
+                              (size_t)w * ((options->depth == 16) ? 8 : 4),
+                              SBIF_RGBA, options, s);
+}
+
+// -----------------------------------------------------------------------
+// indices only go with a palette of up to 256 colors and a palette is
+// only ever of interleaved pixels
+
+static int check_format(sbif_format_t format, sbif_options_t *options)
+{
+    if (format == SBIF_INDEXED)
+    {
+        return ((options->colors < 1) || (options->colors > 256) ||
+                (options->palette == NULL) ||
+                ((unsigned)options->palette_format > SBIF_GREY_ALPHA) ||
+                (options->palette_format == SBIF_PLANAR)) ? -1 : 0;
+    }
+
+    return (((unsigned)format > SBIF_GREY_ALPHA) || (options->colors != 0))
+        ? -1 : 0;
+}
+
+// -----------------------------------------------------------------------
+// compress width x height pixels of any format out to fp
+
+int sbif_encode_pixels(FILE *fp, uint8_t *p, uint32_t w, uint32_t h,
+    size_t line, sbif_format_t format, sbif_options_t *options,
+    sbif_stats_t *s)
+{
+    uint32_t x, y;
+    double t;
+
+    if (check_format(format, options) != 0)
+    {
+        printf("Bad Format\n");
+        return -1;
+    }
+
+    out_fp = fp;
+    pixels = p;
+    stride = line;
+    layout = layouts[format];
+
+    plane  = (format == SBIF_PLANAR) ? line * h : 0;
+    stats  = s;
+
+    set_image(w, h, options);
+
+    bpp    = format_bpp[format] * bytes;
+
+    // an indexed image has the channels of its palette
+
+    palette        = options->palette;
+    palette_format = options->palette_format;
+
+    channels = format_channels[colors ? palette_format : format];
+    color    = format_color[colors ? palette_format : format];
+    planes   = colors ? 1 : channels;
+
+    num_frames = 0;
+    num_tags   = 0;
+    memset(stats, 0, sizeof(*stats));
+
+    arena_used = 0;
+
+    get_buffers();          // first time round just sizes the arena
+    arena_reserve(arena_used);
+    get_buffers();
+
+    // compress each channel of each tile independently
+
+    for (y = 0; y < image_h; y += tile_h)
+    {
+        for (x = 0; x < image_w; x += tile_w)
+        {
+            compress_tile(x, y);
+        }
+    }
+
+    // the seek table is only needed if there is more than one frame.  an
+    // empty image has no tile to have written the header either
+
+    t = sbif_now();
+
+    if (num_frames == 0)
+    {
+        write_header();
+        write_palette();
+    }
+
+    if (num_frames != 1)
+    {
+        write_seek_table();
+    }
+
+    stats->write += sbif_now() - t;
+
+    stats->pixels   = size;
+    stats->frames   = num_frames;
+    stats->tags     = tag_buff;
+    stats->num_tags = num_tags;
+
+    stats->bytes  = sizeof(sbif_header_t) + (colors * channels);
+    stats->bytes += stats->stage3_bytes;
+    stats->bytes += (num_frames != 1) ? (num_frames * 8) + 8 + SEEK_FOOTER : 0;
+
+    return 0;
+}
+
+// =======================================================================
@@ -1,11 +1,68 @@
 // sbif.h    The somewhat better image format header
 // -----------------------------------------------------------------------
 
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
 // -----------------------------------------------------------------------
 
+// the run markers every image starts out with.  the two an image ends up
+// using are in its header, a MARK8 run has an 8 bit count and a MARK16
+// run has a count of any size, seven bits a byte most significant first
+// with the top bit set on every byte but the last
+
 #define MARK8  (0xfc)
 #define MARK16 (0xfd)
 
+#define SBIF_VERSION  13    // bumped whenever the header layout changes
+
+#define GRAPH_END (0xff)    // ends each channel of the recorded tags
+
+#define ARENA_ALIGN(n) (((n) + 63) & ~(size_t)63)   // cache line aligned
+
+// a tiled image ends with a zstd seekable format seek table
+
+#define SEEK_SKIPPABLE  (0x184d2a5e)    // skippable frame magic
+#define SEEK_MAGIC      (0x8f92eab1)    // seek table footer magic
+#define SEEK_FOOTER     (9)             // frame count, descriptor, magic
+
+// -----------------------------------------------------------------------
+// rice coded literals (sbif -r)
+
+// a rice coded scan line has a two bit k parameter after its tag.  each
+// literal is zigzag mapped so small positive and negative deltas become
+// small numbers and is then written as a unary quotient (z >> k ONE bits
+// and a ZERO bit) followed by the low k bits of z.  quotients that would
+// be RICE_LIMIT or more bits long are written as RICE_LIMIT ONE bits
+// followed by all eight (or sixteen) bits of z.  16 bit deltas are eight
+// bits wider so their k is eight bigger than the two bit k says
+
+#define RICE        8       // added to a differential tag for its rice form
+#define RICE_LIMIT  6       // longest unary quotient before escaping
+
+// -----------------------------------------------------------------------
+// shifted vertical copies (sbif -s)
+
+// a shifted scan line has a SHIFT_BITS wide shift after its tag, biased
+// by SHIFT_MAX so it can be anything from -SHIFT_MAX to SHIFT_MAX - 1.
+// each pixel is then compared with the pixel above it that many pixels
+// to the left (or right if negative), clamped to the ends of the scan
+// line, exactly like vertical compression does with the one straight up
+
+#define SHIFT_BITS  4
+#define SHIFT_MAX   (1 << (SHIFT_BITS - 1))
+
+// -----------------------------------------------------------------------
+// continuous bits (sbif -c)
+
+// scan lines are not flushed out to a byte boundary, the bits of each one
+// and the runs they make carry straight on into the next.  that only
+// stops at the end of every SEGMENT_ROWS scan lines of a channel so the
+// threads still have somewhere to start
+
+#define SEGMENT_ROWS  64
+
 // -----------------------------------------------------------------------
 
 typedef enum
@@ -14,18 +71,269 @@ typedef enum
     VERTICAL        = 1,
     HORIZONTAL_DIFF = 2,
     VERTICAL_DIFF   = 3,
-    OFFSET_DIFF     = 4
+    OFFSET_DIFF     = 4,
+    PAETH_DIFF      = 5,    // max mode only (sbif -m)
+    AVERAGE_DIFF    = 6,
+    GRADIENT_DIFF   = 7,
+
+    // tags 8 and up need four bit tags (sbif -r or -s)
+
+    REPEAT          = 8,    // scan line is the same as the one above it
+    SHIFTED         = 9,    // shifted vertical copy
+
+    H_DIFF_RICE     = 10,   // rice coded forms of tags 2 through 7
+    V_DIFF_RICE     = 11,
+    O_DIFF_RICE     = 12,
+    P_DIFF_RICE     = 13,
+    A_DIFF_RICE     = 14,
+    G_DIFF_RICE     = 15,
+
+    // tags 16 and up need five bit tags (sbif -x)
+
+    CROSS_DIFF      = 16,   // deltas against the channel before
+    X_DIFF_RICE     = 24,   // and its rice coded form
+
+    NUM_TAGS        = 32
 } tag_t;
 
 // -----------------------------------------------------------------------
+// the glyph each method is graphed with (sbif -v, dsbif -v)
+
+static const char *glyph[NUM_TAGS] =
+{
+    "▬", "▮", "▭", "▯", "◈", "▰", "▱", "◇",
+    "═", "⇆", "▹", "▿", "◊", "▪", "▫", "◆",
+    "◫", " ", " ", " ", " ", " ", " ", " ",
+    "◪", " ", " ", " ", " ", " ", " ", " "
+};
+
+// -----------------------------------------------------------------------
+// pixel predictors for the max mode differential methods.
+//
+// a is the pixel to the left, b is the pixel above and c is the pixel
+// above and to the left, and the prediction is made from whatever those
+// are.  it is only ever called for the second pixel of a scan line on,
+// the first one has nothing to its left and both the compressor and the
+// decompressor predict it from the pixel above themselves
+
+static inline uint16_t predict(tag_t tag, uint16_t a, uint16_t b,
+    uint16_t c, uint16_t max)
+{
+    int p, pa, pb, pc;
+
+    switch (tag)
+    {
+        case PAETH_DIFF:
+            p  = a + b - c;
+            pa = (p > a) ? p - a : a - p;
+            pb = (p > b) ? p - b : b - p;
+            pc = (p > c) ? p - c : c - p;
+
+            return ((pa <= pb) && (pa <= pc))
+                ? a
+                : (pb <= pc) ? b : c;
+
+        case AVERAGE_DIFF:
+            return (uint16_t)((a + b) >> 1);
+
+        default:            // GRADIENT_DIFF
+            p = a + b - c;
+            return (p < 0) ? 0 : (p > max) ? max : (uint16_t)p;
+    }
+}
+
+// -----------------------------------------------------------------------
+
+// the version byte is eight bytes in in every version of the header
+
+#define FLAG_SPLIT       (0x01) // literals in a stream of their own (sbif -l)
+#define FLAG_CONTINUOUS  (0x02) // scan lines are not padded out (sbif -c)
 
 typedef struct
 {
     uint32_t magic;
-    uint16_t width;
-    uint16_t height;
+    uint32_t width;
+    uint8_t  version;       // SBIF_VERSION
+    uint8_t  tag_bits;      // 3, or 4 or 5 if any tag can be 8 or 16
+    uint8_t  channels;      // 1 to 4
+    uint8_t  color;         // which ones, as a PNG color type
+    uint32_t height;
+    uint32_t tile_w;        // tile size, same as image size if not tiled
+    uint32_t tile_h;
+    uint8_t  depth;         // bits per channel, 8 or 16
+    uint8_t  flags;         // FLAG_SPLIT, FLAG_CONTINUOUS
+    uint16_t colors;        // palette entries after the header, 0 if none
+    uint8_t  mark8;         // run markers, MARK8 and MARK16 unless some
+    uint8_t  mark16;        // other bytes were cheaper to escape
+    uint16_t reserved;
 } sbif_header_t;
 
+// -----------------------------------------------------------------------
+// mask is 0xff or 0xffff (or less for palette indices), every delta wraps
+// around at the channel depth
+
+static inline uint16_t zigzag(uint16_t c, uint16_t mask)
+{
+    return ((c << 1) ^ ((c > (mask >> 1)) ? mask : 0)) & mask;
+}
+
+static inline uint16_t unzigzag(uint16_t z, uint16_t mask)
+{
+    return ((z >> 1) ^ -(z & 1)) & mask;
+}
+
+// -----------------------------------------------------------------------
+// library interface.  sbif.c has the compression side and dsbif.c the
+// decompression side, neither of them are thread safe
+
+// the layout of the pixels of an image being compressed or decompressed.
+// only the channels an image actually has are stored, the header says
+// which using the PNG color types.  decompressing an image to a format
+// with channels it does not have copies grey to red, green and blue or
+// gives an opaque alpha, and red is used for grey.  planar is each channel
+// one after the other, which is what dsbif writes to outfile.raw by
+// default (when compressing planar is always four channels).  16 bit
+// pixels are the same thing with a native uint16_t per channel, strides
+// are still in bytes.  indexed is a byte per pixel, an index into the
+// palette given in the options
+
+typedef enum
+{
+    SBIF_RGBA       = 0,
+    SBIF_BGRA       = 1,
+    SBIF_RGB        = 2,
+    SBIF_GREY       = 3,
+    SBIF_PLANAR     = 4,
+    SBIF_GREY_ALPHA = 5,
+    SBIF_INDEXED    = 6     // compressing only, see palette mode
+} sbif_format_t;
+
+static const uint8_t format_bpp[7] = { 4, 4, 3, 1, 1, 2, 1 };
+
+typedef struct
+{
+    int max_mode;           // also try the predictor methods (sbif -m)
+    int rice_mode;          // also try rice coded literals (sbif -r)
+    int shift_mode;         // also try shifted vertical copies (sbif -s)
+    int cross_mode;         // also try deltas across channels (sbif -x)
+    int split_mode;         // literals in a stream of their own (sbif -l)
+    int continuous;         // scan lines are not padded out (sbif -c)
+    int entropy_mode;       // pick methods by estimated zstd cost (sbif -e),
+                            // ignored if continuous
+    int repeat_mode;        // REPEAT scan lines same as above (sbif -u),
+    int copy_mode;          // or any earlier one (sbif -k).  both need 4
+                            // bit tags, and are on anyway with -r, -s, -x
+    int64_t tile_w;         // tile size (sbif -t), zero for none, bands
+    int64_t tile_h;         // (sbif -b) have a negative tile_w
+    int depth;              // 16 if the pixels are uint16_t, 8 otherwise
+    int threads;            // to split each channel between (sbif -j)
+
+    uint8_t *palette;       // SBIF_INDEXED pixels index this many colors
+    int colors;             // (up to 256), each one pixel of palette_format
+    sbif_format_t palette_format;
+} sbif_options_t;
+
+// PNG color types
+
+#define COLOR_GREY        (0)
+#define COLOR_RGB         (2)
+#define COLOR_GREY_ALPHA  (4)
+#define COLOR_RGBA        (6)
+
+// what each stage cost, added up over every tile and channel.  times are
+// in milliseconds.  the library fills in everything but load and total
+// which are up to the caller
+
+typedef struct
+{
+    double load;            // decoding the PNG or reading the .sbz file
+    double split;           // separating the color channels
+    double stage12;         // sb_compress() or sb_decompress()
+    double method[NUM_TAGS]; // the part of stage12 spent in each method
+    double stage3;          // zstd
+    double copy;            // copying a region out of a partial tile
+    double write;           // writing the compressed output
+    double total;
+
+    uint64_t pixels;        // per channel, of the image or region
+    uint64_t rows;          // scan lines over every channel of every tile
+    uint64_t tries[NUM_TAGS]; // compressed or decompressed by each method
+    uint64_t wins[4][NUM_TAGS]; // scan lines each method was picked for
+    uint64_t cost[4][NUM_TAGS]; // bytes each method produced when tried
+    uint64_t frames;        // zstd frames
+    uint64_t stage12_bytes; // stage two output, what zstd gets to eat
+    uint64_t stage3_bytes;  // zstd output
+    uint64_t mark8;         // runs in the stage two output
+    uint64_t mark16;
+    int64_t rle_saved;      // bytes those runs saved, less escaped markers
+    uint64_t bytes;         // the whole .sbz file, compression only
+
+    uint8_t *tags;          // method of every scan line, in order.  owned
+    size_t num_tags;        // by the library, good till it is next called
+} sbif_stats_t;
+
+int sbif_encode(FILE *fp, uint8_t *rgba, uint32_t w, uint32_t h,
+    sbif_options_t *options, sbif_stats_t *stats);
+
+// the same thing from pixels in any of the above formats, each scan line
+// being stride bytes after the one before it.  only the channels of the
+// format are compressed.  both return -1 without writing anything if the
+// format is not one of them, or is SBIF_INDEXED without a palette
+
+int sbif_encode_pixels(FILE *fp, uint8_t *pixels, uint32_t w, uint32_t h,
+    size_t stride, sbif_format_t format, sbif_options_t *options,
+    sbif_stats_t *stats);
+
+size_t sbif_compress_bound(uint32_t w, uint32_t h, sbif_options_t *options);
+
+// the working buffers are kept around for the next image, these give
+// them back
+
+void sbif_encode_free(void);
+void sbif_decode_free(void);
+
+int sbif_info(uint8_t *in, size_t len, uint32_t *w, uint32_t *h,
+    int *channels, int *depth);
+
+int sbif_decode(uint8_t *in, size_t len, uint8_t *out,
+    int64_t x, int64_t y, int64_t w, int64_t h, sbif_stats_t *stats);
+
+// the same thing into pixels of any of the above formats but indexed,
+// each scan line of the region being stride bytes after the one before it
+
+int sbif_decode_pixels(uint8_t *in, size_t len, uint8_t *out,
+    size_t stride, sbif_format_t format, int64_t x, int64_t y,
+    int64_t w, int64_t h, sbif_stats_t *stats);
+
+// -----------------------------------------------------------------------
+// graph the method of each scan line of each channel.  if the compression
+// graph is different from the decompression graph then one or other of
+// them is broken.  this was actually a very helpful tool during
+// development.  it also looks cool and scientifical !
+
+static inline void sbif_graph(FILE *fp, sbif_stats_t *stats)
+{
+    size_t i;
+
+    for (i = 0; i != stats->num_tags; i++)
+    {
+        fputs((stats->tags[i] == GRAPH_END)
+            ? "\n\n"
+            : glyph[stats->tags[i]], fp);
+    }
+}
+
+// -----------------------------------------------------------------------
+// a millisecond clock that only ever goes forwards
+
+static inline double sbif_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
 // -----------------------------------------------------------------------
 // because c is fkkn annoying
 
@@ -0,0 +1,261 @@
+// sbif_cli.c  - The SOMETIMES better image format compressor
+// -----------------------------------------------------------------------
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "sbif.h"
+#include "sbif_png.h"
+#include "lodepng.h"
+
+// -----------------------------------------------------------------------
+
+char *infile;               // input file name
+char *outfile;              // output file name
+
+sbif_png_t png;             // decoding PNG should be simpler
+
+sbif_options_t options;
+sbif_stats_t stats;
+
+int verbose;                // sbif -v graphs each scan lines method
+int no_palette;             // sbif -P never compresses indices
+int show_stats;             // sbif --stats, to stats_file or stdout
+char *stats_file;
+
+// the name each method goes by in --stats output
+
+const char *tag_name[NUM_TAGS] =
+{
+    "horizontal", "vertical", "horizontal_diff", "vertical_diff",
+    "offset_diff", "paeth_diff", "average_diff", "gradient_diff",
+    "repeat", "shifted", "h_diff_rice", "v_diff_rice",
+    "o_diff_rice", "p_diff_rice", "a_diff_rice", "g_diff_rice",
+    "cross_diff", "", "", "", "", "", "", "",
+    "x_diff_rice", "", "", "", "", "", "", ""
+};
+
+struct option long_opts[] =
+{
+    { "stats", optional_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 }
+};
+
+// -----------------------------------------------------------------------
+// save out the uncompressed data one channel after the other so we can
+// verify our decompression results
+
+static void write_raw(void)
+{
+    FILE *raw_fp;
+    size_t i;
+    size_t size;
+    int c;
+    int bpp;
+    int n;                  // bytes per channel
+
+    raw_fp = fopen("image.raw", "wb");
+    size   = (size_t)png.width * png.height;
+    n      = png.depth / 8;
+    bpp    = format_bpp[png.format] * n;
+
+    for (c = 0; c != format_bpp[png.format]; c++)
+    {
+        for (i = 0; i != size; i++)
+        {
+            fwrite(&png.pixels[(i * bpp) + (c * n)], 1, n, raw_fp);
+        }
+    }
+
+    fclose(raw_fp);
+}
+
+// -----------------------------------------------------------------------
+// the count for tag t in each color channel as a json array
+
+static void write_rgba(FILE *fp, char *name, uint64_t n[][NUM_TAGS], tag_t t)
+{
+    fprintf(fp, ", \"%s\": [ %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %"
+                PRIu64 " ]", name, n[0][t], n[1][t], n[2][t], n[3][t]);
+}
+
+// -----------------------------------------------------------------------
+// everything in stats as json
+
+static void write_stats(void)
+{
+    FILE *fp;
+    tag_t t;
+    char *sep = "";
+    uint64_t raw = stats.pixels * format_bpp[png.format] * (png.depth / 8);
+
+    fp = (stats_file != NULL) ? fopen(stats_file, "w") : stdout;
+
+    fprintf(fp, "{\n  \"file\": \"%s\", \"width\": %u, \"height\": %u,\n",
+            infile, png.width, png.height);
+
+    fprintf(fp, "  \"ms\": { \"load_png\": %.3f, \"split\": %.3f, "
+                "\"stage12\": %.3f, \"stage3\": %.3f, \"write\": %.3f, "
+                "\"total\": %.3f },\n", stats.load, stats.split,
+            stats.stage12, stats.stage3, stats.write, stats.total);
+
+    fprintf(fp, "  \"methods\": {");
+
+    for (t = HORIZONTAL; t != NUM_TAGS; t++)
+    {
+        if (stats.tries[t] != 0)
+        {
+            fprintf(fp, "%s\n    \"%s\": { \"tries\": %" PRIu64 ", "
+                        "\"ms\": %.3f", sep, tag_name[t], stats.tries[t],
+                    stats.method[t]);
+
+            write_rgba(fp, "wins",  stats.wins, t);
+            write_rgba(fp, "bytes", stats.cost, t);
+
+            fprintf(fp, " }");
+            sep = ",";
+        }
+    }
+
+    fprintf(fp, "\n  },\n  \"pixels\": %" PRIu64 ", \"rows\": %" PRIu64 ", "
+                "\"frames\": %" PRIu64 ",\n", stats.pixels, stats.rows,
+            stats.frames);
+
+    fprintf(fp, "  \"rle\": { \"mark8\": %" PRIu64 ", \"mark16\": %" PRIu64
+                ", \"saved\": %" PRId64 " },\n", stats.mark8, stats.mark16,
+            stats.rle_saved);
+
+    fprintf(fp, "  \"ratio\": { \"stage3\": %.4f, \"total\": %.4f },\n",
+            (double)stats.stage12_bytes / stats.stage3_bytes,
+            (double)raw / stats.bytes);
+
+    fprintf(fp, "  \"bytes\": { \"raw\": %" PRIu64 ", \"stage12\": %"
+                PRIu64 ", \"stage3\": %" PRIu64 ", \"file\": %" PRIu64
+                " }\n}\n", raw, stats.stage12_bytes,
+            stats.stage3_bytes, stats.bytes);
+
+    (fp != stdout) ? fclose(fp) : fflush(fp);
+}
+
+// -----------------------------------------------------------------------
+
+void main(int argc, char **argv)
+{
+    int opt;
+    double start;
+    double load;
+    unsigned error;
+    FILE *out_fp;
+
+    options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt_long(argc, argv, "mrsxlceukvPt:b:j:", long_opts,
+                              NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'm': options.max_mode     = 1;  break;
+            case 'r': options.rice_mode    = 1;  break;
+            case 's': options.shift_mode   = 1;  break;
+            case 'x': options.cross_mode   = 1;  break;
+            case 'l': options.split_mode   = 1;  break;
+            case 'c': options.continuous   = 1;  break;
+            case 'e': options.entropy_mode = 1;  break;
+            case 'u': options.repeat_mode  = 1;  break;
+            case 'k': options.copy_mode    = 1;  break;
+            case 'v': verbose              = 1;  break;
+            case 'P': no_palette           = 1;  break;
+
+            case 'S':
+                show_stats = 1;
+                stats_file = optarg;
+                break;
+
+            case 't':
+                options.tile_w = options.tile_h = atoll(optarg);
+                break;
+
+            case 'b':
+                options.tile_w = -1;
+                options.tile_h = atoll(optarg);
+                break;
+
+            case 'j':
+                options.threads = atoi(optarg);
+                break;
+
+            default:
+                printf("usage: sbif [-m] [-r] [-s] [-x] [-l] [-c] [-e] [-u] "
+                       "[-k] [-v] [-P] [-t size | -b rows] [-j threads] "
+                       "[--stats[=file]] infile.png outfile.sbz\n"
+                       "  -u repeats the scan line above and -k copies any "
+                       "earlier one, both take four\n"
+                       "  bit tags (-r, -s and -x have them anyway and "
+                       "get both)\n"
+                       "  -e and -c can not be used together\n");
+                exit(0);
+        }
+    }
+
+    // the bytes of a continuous try are not the ones that get written out
+    // so there is nothing for entropy mode to count, rather than quietly
+    // do without it say so
+
+    if (options.entropy_mode && options.continuous)
+    {
+        printf("sbif: -e and -c can not be used together\n");
+        exit(0);
+    }
+
+    infile  = argv[optind];
+    outfile = argv[optind + 1];
+
+    start = sbif_now();
+    error = sbif_png_load(infile, &png);
+
+    if (error)
+    {
+        printf("error %u: %s\n", error, lodepng_error_text(error));
+        exit(0);
+    }
+
+    if (!no_palette)
+    {
+        sbif_png_palette(&png);
+    }
+
+    load  = sbif_now() - start;
+
+    out_fp = fopen(outfile, "wb");
+    printf("%s %u %u\n\n", infile, png.width, png.height);
+
+    write_raw();
+
+    start = sbif_now();
+    sbif_png_encode(out_fp, &png, &options, &stats);
+    fclose(out_fp);
+
+    stats.total = sbif_now() - start;
+    stats.load  = load;
+
+    if (verbose)
+    {
+        sbif_graph(stdout, &stats);
+    }
+
+    printf("%dms\n\n", (int)stats.total);
+
+    if (show_stats)
+    {
+        write_stats();
+    }
+
+    // misra violation!  Guru Meditation, too lazy to free buffers
+}
+
+// =======================================================================
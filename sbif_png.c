@@ -0,0 +1,226 @@
+// sbif_png.c  - PNG files as sbif wants to compress them
+// -----------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sbif.h"
+#include "sbif_png.h"
+#include "lodepng.h"        // makes the build 487658265295 times slower
+
+// -----------------------------------------------------------------------
+
+static const LodePNGColorType png_types[6] =
+{
+    [SBIF_RGBA]       = LCT_RGBA,
+    [SBIF_RGB]        = LCT_RGB,
+    [SBIF_GREY]       = LCT_GREY,
+    [SBIF_GREY_ALPHA] = LCT_GREY_ALPHA
+};
+
+// -----------------------------------------------------------------------
+// only the channels the png actually has get compressed.  palette images
+// are expanded out to rgba, as is anything with a transparent color key.
+// 16 bit pngs stay 16 bit
+
+unsigned sbif_png_load(const char *file, sbif_png_t *png)
+{
+    unsigned error;
+    unsigned w, h;
+    uint8_t *data;
+    size_t len;
+    size_t i;
+    uint16_t s;
+    LodePNGState state;
+
+    memset(png, 0, sizeof(*png));
+    lodepng_state_init(&state);
+
+    error = lodepng_load_file(&data, &len, file);
+    error = error ? error
+        : lodepng_inspect(&w, &h, &state, data, len);
+
+    switch (state.info_png.color.colortype)
+    {
+        case LCT_GREY:        png->format = SBIF_GREY;        break;
+        case LCT_GREY_ALPHA:  png->format = SBIF_GREY_ALPHA;  break;
+        case LCT_RGB:         png->format = SBIF_RGB;         break;
+        default:              png->format = SBIF_RGBA;        break;
+    }
+
+    if (state.info_png.color.key_defined)
+    {
+        png->format = (png->format == SBIF_GREY) ? SBIF_GREY_ALPHA
+                                                 : SBIF_RGBA;
+    }
+
+    png->depth = (state.info_png.color.bitdepth == 16) ? 16 : 8;
+
+    error = error ? error
+        : lodepng_decode_memory(&png->pixels, &w, &h, data, len,
+                                png_types[png->format], png->depth);
+
+    lodepng_state_cleanup(&state);
+    free(data);
+
+    if (error)
+    {
+        return error;
+    }
+
+    png->width  = w;
+    png->height = h;
+
+    // png is big endian, sbif wants native uint16_t
+
+    if (png->depth == 16)
+    {
+        len = (size_t)w * h * format_bpp[png->format];
+
+        for (i = 0; i != len; i++)
+        {
+            s = (png->pixels[i * 2] << 8) | png->pixels[(i * 2) + 1];
+            memcpy(&png->pixels[i * 2], &s, 2);
+        }
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+// order palette entries by brightness, then alpha
+
+static int brightness(const void *a, const void *b)
+{
+    const uint8_t *p = a;
+    const uint8_t *q = b;
+    int n;
+
+    n = ((p[0] * 299) + (p[1] * 587) + (p[2] * 114)) -
+        ((q[0] * 299) + (q[1] * 587) + (q[2] * 114));
+
+    return (n != 0) ? n : p[3] - q[3];
+}
+
+// -----------------------------------------------------------------------
+// where color c of n bytes is in the palette, hashed
+
+static int lookup(int16_t *table, uint32_t *keys, uint8_t *c, int n)
+{
+    uint32_t k = 0;
+    uint32_t h;
+
+    memcpy(&k, c, n);
+
+    for (h = (k * 2654435761u) >> 22; table[h] >= 0; h = (h + 1) & 1023)
+    {
+        if (keys[h] == k)
+        {
+            break;
+        }
+    }
+
+    keys[h] = k;
+    return h;
+}
+
+// -----------------------------------------------------------------------
+// an 8 bit image with no more than 256 colors is compressed as a single
+// plane of indices into a palette instead of a plane per channel.  the
+// palette is sorted by brightness so that similar colors get similar
+// indices which keeps the deltas between them small.  grey images are
+// already one plane so they are left alone
+
+void sbif_png_palette(sbif_png_t *png)
+{
+    LodePNGColorStats cs;
+    LodePNGColorMode mode;
+    int16_t table[1024];
+    uint32_t keys[1024];
+    size_t size;
+    size_t i;
+    int n;
+    int h;
+    uint8_t *p;
+
+    if ((png->depth == 16) || (png->format == SBIF_GREY))
+    {
+        return;
+    }
+
+    lodepng_color_stats_init(&cs);
+    mode = lodepng_color_mode_make(png_types[png->format], 8);
+
+    if ((lodepng_compute_color_stats(&cs, png->pixels, png->width,
+                                     png->height, &mode) != 0) ||
+        (cs.numcolors == 0) || (cs.numcolors > 256))
+    {
+        return;
+    }
+
+    qsort(cs.palette, cs.numcolors, 4, brightness);
+
+    // the stats palette is rgba whatever the image is, ours is the same
+    // format as the image
+
+    n    = format_bpp[png->format];
+    size = (size_t)png->width * png->height;
+
+    memset(table, 0xff, sizeof(table));
+
+    for (i = 0; i != cs.numcolors; i++)
+    {
+        p = &png->palette[i * n];
+
+        memcpy(p, &cs.palette[i * 4], (n == 2) ? 1 : n);
+        p[1] = (n == 2) ? cs.palette[(i * 4) + 3] : p[1];
+
+        h = lookup(table, keys, p, n);
+        table[h] = i;
+    }
+
+    png->indices = malloc(size);
+
+    for (i = 0; i != size; i++)
+    {
+        png->indices[i] = table[lookup(table, keys, &png->pixels[i * n], n)];
+    }
+
+    png->colors = cs.numcolors;
+}
+
+// -----------------------------------------------------------------------
+
+int sbif_png_encode(FILE *fp, sbif_png_t *png, sbif_options_t *options,
+    sbif_stats_t *stats)
+{
+    options->depth          = png->depth;
+    options->palette        = png->palette;
+    options->colors         = png->colors;
+    options->palette_format = png->format;
+
+    if (png->colors != 0)
+    {
+        return sbif_encode_pixels(fp, png->indices, png->width, png->height,
+                                  png->width, SBIF_INDEXED, options, stats);
+    }
+
+    return sbif_encode_pixels(fp, png->pixels, png->width, png->height,
+                              (size_t)png->width * format_bpp[png->format] *
+                              (png->depth / 8), png->format, options, stats);
+}
+
+// -----------------------------------------------------------------------
+
+void sbif_png_free(sbif_png_t *png)
+{
+    free(png->pixels);
+    free(png->indices);
+
+    png->pixels  = NULL;
+    png->indices = NULL;
+}
+
+// =======================================================================
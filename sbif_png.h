@@ -0,0 +1,41 @@
+// sbif_png.h  - PNG files as sbif wants to compress them
+// -----------------------------------------------------------------------
+
+// shared by sbif and the benchmark so that both compress exactly the same
+// pixels.  needs sbif.h and lodepng.c
+
+// -----------------------------------------------------------------------
+
+typedef struct
+{
+    uint32_t width;
+    uint32_t height;
+
+    uint8_t *pixels;        // only the channels the png actually has, as
+    sbif_format_t format;   // grey, grey alpha, rgb or rgba
+    int depth;              // 16 bit pngs stay 16 bit, native uint16_t
+
+    uint8_t *indices;       // pixels as indices into palette, if it has
+    uint8_t palette[256 * 4]; // few enough colors (each one of format)
+    int colors;             // zero if not
+} sbif_png_t;
+
+// load file into png, returns a lodepng error code (lodepng_error_text()
+// says what it means) or 0
+
+unsigned sbif_png_load(const char *file, sbif_png_t *png);
+
+// look for a palette, which only 8 bit images with 256 colors or less that
+// are not grey get
+
+void sbif_png_palette(sbif_png_t *png);
+
+// compress png to fp as indices if it has a palette and as its own pixels
+// if not.  sets the depth and palette of options to match
+
+int sbif_png_encode(FILE *fp, sbif_png_t *png, sbif_options_t *options,
+    sbif_stats_t *stats);
+
+void sbif_png_free(sbif_png_t *png);
+
+// =======================================================================
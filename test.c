@@ -0,0 +1,327 @@
+// test.c    - round trips through sbif and dsbif that once went wrong
+// -----------------------------------------------------------------------
+
+// each test compresses a small made up image in memory and checks what
+// comes back out.  every test that fails is named and the exit status is
+// non zero if any of them did
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+
+#include "sbif.h"
+
+// -----------------------------------------------------------------------
+
+int failed;
+
+sbif_options_t options;
+sbif_stats_t stats;
+
+// -----------------------------------------------------------------------
+
+static void check(const char *name, int ok)
+{
+    printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+    failed |= !ok;
+}
+
+// -----------------------------------------------------------------------
+// noisy enough that every method gets a look in, but the same every time
+
+static void make_grey16(uint16_t *p, uint32_t w, uint32_t h)
+{
+    uint32_t seed = 1;
+    uint32_t x, y;
+
+    for (y = 0; y != h; y++)
+    {
+        for (x = 0; x != w; x++)
+        {
+            seed = (seed * 1103515245) + 12345;
+            p[(y * w) + x] = (x * 300) + (y * 200) + ((seed >> 16) & 0xff);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------
+// compress w x h pixels into a buffer of their own
+
+static uint8_t *encode(uint8_t *p, uint32_t w, uint32_t h, size_t stride,
+    sbif_format_t format, size_t *len)
+{
+    uint8_t *out = NULL;
+    FILE *fp;
+
+    fp = open_memstream((char **)&out, len);
+    sbif_encode_pixels(fp, p, w, h, stride, format, &options, &stats);
+    fclose(fp);
+
+    return out;
+}
+
+// -----------------------------------------------------------------------
+// a 16 bit region as wide as one tile but not lined up with the tiles
+// used to be decompressed straight into the output as if it were
+
+static void region_16(void)
+{
+    uint32_t w = 200, h = 131;
+    int64_t rx[3] = { 0, 10, 70 };
+    uint16_t *src, *out;
+    uint8_t *comp;
+    size_t len;
+    int64_t i, j;
+    int n, ok;
+
+    src = malloc(w * h * 2);
+    out = malloc(64 * h * 2);
+
+    make_grey16(src, w, h);
+
+    memset(&options, 0, sizeof(options));
+    options.depth  = 16;
+    options.tile_w = options.tile_h = 64;
+
+    comp = encode((uint8_t *)src, w, h, w * 2, SBIF_GREY, &len);
+
+    for (n = 0, ok = 1; n != 3; n++)
+    {
+        ok &= (sbif_decode_pixels(comp, len, (uint8_t *)out, 64 * 2,
+                                  SBIF_GREY, rx[n], 0, 64, h, &stats) == 0);
+
+        for (j = 0; j != h; j++)
+        {
+            for (i = 0; i != 64; i++)
+            {
+                ok &= (out[(j * 64) + i] == src[(j * w) + rx[n] + i]);
+            }
+        }
+    }
+
+    check("16 bit region one tile wide, off the tile grid", ok);
+
+    free(comp);
+    free(src);
+    free(out);
+}
+
+// -----------------------------------------------------------------------
+// an image with no width or no height used to have a tile size of zero
+// to divide by
+
+static void bound_empty(void)
+{
+    size_t none;
+
+    memset(&options, 0, sizeof(options));
+
+    none = sbif_compress_bound(0, 0, &options);
+
+    check("compress bound of an empty image",
+          (none >= sizeof(sbif_header_t)) &&
+          (sbif_compress_bound(0, 100, &options) == none) &&
+          (sbif_compress_bound(100, 0, &options) == none));
+}
+
+// -----------------------------------------------------------------------
+// an empty image has no tile to write the header out with, it still has
+// to end up in the file, with an empty seek table after it
+
+static void encode_empty(void)
+{
+    uint32_t dims[3][2] = { { 0, 0 }, { 0, 7 }, { 7, 0 } };
+    uint8_t pixel[4];
+    uint8_t *comp;
+    size_t len;
+    uint32_t w, h;
+    int c, d;
+    int n, ok;
+
+    memset(&options, 0, sizeof(options));
+
+    for (n = 0, ok = 1; n != 3; n++)
+    {
+        comp = encode(pixel, dims[n][0], dims[n][1], 0, SBIF_RGBA, &len);
+
+        ok &= (len == stats.bytes) && (stats.frames == 0) &&
+              (sbif_info(comp, len, &w, &h, &c, &d) == 0) &&
+              (w == dims[n][0]) && (h == dims[n][1]) && (c == 4);
+
+        free(comp);
+    }
+
+    check("empty images still have a header", ok);
+}
+
+// -----------------------------------------------------------------------
+// the first scan line of a single frame file gets a tag of t (5 bits),
+// the header says the tags are n bits wide
+
+static int bad_tag(uint8_t *comp, size_t len, uint8_t t, uint8_t n)
+{
+    sbif_header_t *header;
+    uint8_t *file;
+    uint8_t *frame;
+    size_t size;
+    uint16_t out[64 * 64];
+    int r;
+
+    file   = malloc(ZSTD_compressBound(64 * 64 * 4) + len);
+    header = (sbif_header_t *)file;
+
+    memcpy(file, comp, sizeof(sbif_header_t));
+
+    size  = ZSTD_getFrameContentSize(comp + sizeof(*header),
+                                     len - sizeof(*header));
+    frame = malloc(size);
+
+    ZSTD_decompress(frame, size, comp + sizeof(*header),
+                    len - sizeof(*header));
+
+    frame[0] = (frame[0] & 0x07) | (t << 3);
+    header->tag_bits = n;
+
+    size = ZSTD_compress(file + sizeof(*header), ZSTD_compressBound(size),
+                         frame, size, 1);
+
+    r = sbif_decode(file, sizeof(*header) + size, (uint8_t *)out,
+                    0, 0, 64, 64, &stats);
+
+    free(frame);
+    free(file);
+
+    return r;
+}
+
+// -----------------------------------------------------------------------
+// corrupt tags used to be counted in the stats (past the end of them) and
+// then decompressed, cross channel ones with no channel to cross from
+
+static void corrupt_tags(void)
+{
+    uint16_t src[64 * 64];
+    uint8_t *comp;
+    size_t len;
+
+    memset(&options, 0, sizeof(options));
+    options.cross_mode = 1;
+    options.depth      = 16;
+
+    make_grey16(src, 64, 64);
+
+    comp = encode((uint8_t *)src, 64, 64, 64 * 2, SBIF_GREY, &len);
+
+    check("corrupt tags are rejected",
+          (bad_tag(comp, len, HORIZONTAL, 5) == 0) &&
+          (bad_tag(comp, len, HORIZONTAL, 8) != 0) &&
+          (bad_tag(comp, len, 31, 5) != 0) &&
+          (bad_tag(comp, len, CROSS_DIFF, 5) != 0));
+
+    free(comp);
+}
+
+// -----------------------------------------------------------------------
+// tile sizes straight out of the header used to be divided by and used to
+// size the working buffers
+
+static void corrupt_tiles(void)
+{
+    uint32_t tiles[4][2] = { { 0, 16 }, { 16, 0 }, { 65, 16 }, { 16, 65 } };
+    sbif_header_t *header;
+    uint16_t src[64 * 64];
+    uint8_t *comp;
+    size_t len;
+    uint32_t w, h;
+    int c, d;
+    int n, ok;
+
+    memset(&options, 0, sizeof(options));
+    options.depth  = 16;
+    options.tile_w = options.tile_h = 16;
+
+    make_grey16(src, 64, 64);
+
+    comp   = encode((uint8_t *)src, 64, 64, 64 * 2, SBIF_GREY, &len);
+    header = (sbif_header_t *)comp;
+    ok     = (sbif_info(comp, len, &w, &h, &c, &d) == 0);
+
+    for (n = 0; n != 4; n++)
+    {
+        header->tile_w = tiles[n][0];
+        header->tile_h = tiles[n][1];
+
+        ok &= (sbif_info(comp, len, &w, &h, &c, &d) != 0);
+    }
+
+    check("corrupt tile sizes are rejected", ok);
+
+    free(comp);
+}
+
+// -----------------------------------------------------------------------
+// formats past the end of the layout tables used to be looked up in them
+
+static void bad_formats(void)
+{
+    uint8_t rgba[4 * 4 * 4];
+    uint8_t *comp;
+    size_t len;
+    FILE *fp;
+    int ok;
+
+    memset(&options, 0, sizeof(options));
+    memset(rgba, 0x55, sizeof(rgba));
+
+    fp = open_memstream((char **)&comp, &len);
+
+    ok = (sbif_encode_pixels(fp, rgba, 4, 4, 4, SBIF_INDEXED, &options,
+                             &stats) != 0) &&
+         (sbif_encode_pixels(fp, rgba, 4, 4, 16, 7, &options,
+                             &stats) != 0);
+
+    options.colors  = 2;
+    options.palette = rgba;
+
+    ok &= (sbif_encode_pixels(fp, rgba, 4, 4, 16, SBIF_RGBA, &options,
+                              &stats) != 0);
+
+    fclose(fp);
+
+    ok &= (len == 0);
+    free(comp);
+
+    memset(&options, 0, sizeof(options));
+
+    comp = encode(rgba, 4, 4, 16, SBIF_RGBA, &len);
+
+    ok &= (sbif_decode_pixels(comp, len, rgba, 4, SBIF_INDEXED, 0, 0, 4, 4,
+                              &stats) != 0) &&
+          (sbif_decode_pixels(comp, len, rgba, 16, 7, 0, 0, 4, 4,
+                              &stats) != 0);
+
+    check("formats neither side has are rejected", ok);
+
+    free(comp);
+}
+
+// -----------------------------------------------------------------------
+
+int main(void)
+{
+    region_16();
+    bound_empty();
+    encode_empty();
+    corrupt_tags();
+    corrupt_tiles();
+    bad_formats();
+
+    sbif_encode_free();
+    sbif_decode_free();
+
+    return failed;
+}
+
+// =======================================================================